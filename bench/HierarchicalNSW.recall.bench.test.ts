@@ -0,0 +1,81 @@
+/* eslint-disable prefer-const */
+
+import { bench } from 'vitest';
+import { createVectorData } from '~test/testHelpers';
+import { HierarchicalNSW } from '../dist/hnswlib';
+
+// recall@k against exact ground truth from BruteforceSearch, swept over M/efConstruction and efSearch.
+// For larger datasets and fvecs/ivecs files use the native harness (make bench-native BENCH_ARGS="--sweep ...").
+const dimensions = 128;
+const baseIndexSize = 5000;
+const numQueries = 100;
+const k = 10;
+const buildParams = [
+  { m: 8, efConstruction: 100 },
+  { m: 16, efConstruction: 200 },
+  { m: 32, efConstruction: 200 },
+];
+const efSearchList = [10, 20, 40, 80, 160, 320];
+
+const baseData = createVectorData(baseIndexSize, dimensions);
+const queryData = createVectorData(numQueries, dimensions);
+
+const computeGroundTruth = (): number[][] => {
+  const bruteforce = new testHnswlibModule.BruteforceSearch('l2', dimensions);
+  bruteforce.initIndex(baseIndexSize);
+  baseData.vectors.forEach((vec, i) => bruteforce.addPoint(vec, baseData.labels[i]));
+  return queryData.vectors.map((query) => bruteforce.searchKnn(query, k, undefined).neighbors);
+};
+
+const measureRecall = (index: HierarchicalNSW, truth: number[][]) => {
+  const start = performance.now();
+  const results = queryData.vectors.map((query) => index.searchKnn(query, k, undefined).neighbors);
+  const seconds = (performance.now() - start) / 1000;
+
+  let found = 0;
+  results.forEach((neighbors, q) => {
+    const expected = new Set(truth[q]);
+    found += neighbors.filter((label) => expected.has(label)).length;
+  });
+  return { recall: found / (numQueries * k), qps: numQueries / seconds };
+};
+
+const truth = computeGroundTruth();
+
+const indexes = buildParams.map(({ m, efConstruction }) => {
+  const index = new testHnswlibModule.HierarchicalNSW('l2', dimensions, '');
+  index.initIndex(baseIndexSize, m, efConstruction, 100);
+  const start = performance.now();
+  index.addPoints(baseData.vectors, baseData.labels, false);
+  const buildSeconds = (performance.now() - start) / 1000;
+  return { m, efConstruction, buildSeconds, index };
+});
+
+const rows = indexes.flatMap(({ m, efConstruction, buildSeconds, index }) =>
+  efSearchList.map((efSearch) => {
+    index.setEfSearch(efSearch);
+    return { m, efConstruction, buildSeconds, efSearch, ...measureRecall(index, truth) };
+  })
+);
+console.table(rows);
+
+describe(`benchmark searchKnn recall@${k} with ${baseIndexSize} points and ${dimensions} dimensions`, () => {
+  indexes.forEach(({ m, efConstruction, index }) => {
+    efSearchList.forEach((efSearch) => {
+      const { recall } = rows.find((row) => row.m === m && row.efConstruction === efConstruction && row.efSearch === efSearch) ?? {
+        recall: 0,
+      };
+
+      bench(
+        `m=${m} efConstruction=${efConstruction} efSearch=${efSearch} recall=${recall.toFixed(3)}`,
+        () => {
+          index.searchKnn(queryData.vectors[0], k, undefined);
+        },
+        {
+          setup: () => index.setEfSearch(efSearch),
+          iterations: 100,
+        }
+      );
+    });
+  });
+});
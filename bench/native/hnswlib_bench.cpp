@@ -0,0 +1,945 @@
+// Native (and emcc/node) benchmark for the hnswlib core, without the embind layer.
+//
+//   hnswlib_bench [--smoke] [--space l2|ip] [--dim 128] [--n 10000] [--queries 200] [--k 10]
+//                 [--M 16] [--ef-construction 200] [--recall 0.95]
+//                 [--sweep] [--M-list 8,16,32] [--ef-construction-list 100,200] [--ef-list 10,20,40,...]
+//                 [--base base.fvecs] [--query query.fvecs] [--groundtruth groundtruth.ivecs]
+//
+// Reports distance kernel throughput per dimension, build time and the QPS at the first efSearch
+// that reaches the target recall (ground truth from BruteforceSearch).  --sweep builds one index per
+// M x efConstruction pair instead and prints recall@k, QPS and build time for every efSearch of the
+// list as csv.  --base/--query read a local dataset in the fvecs format (SIFT/GIST style, every row is
+// an int32 dimension followed by the values), --groundtruth an ivecs file with the exact neighbors,
+// which is computed with BruteforceSearch when omitted.  Random uniform vectors are used otherwise.
+// --smoke runs a small correctness check instead and exits non zero on failure, it is registered with ctest.
+#include "hnswlib.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+struct Options {
+    bool smoke = false;
+    std::string space = "l2";
+    size_t dim = 128;
+    size_t n = 10000;
+    size_t queries = 200;
+    size_t k = 10;
+    size_t M = 16;
+    size_t efConstruction = 200;
+    double recall = 0.95;
+    bool sweep = false;
+    std::vector<size_t> MList = {8, 16, 32};
+    std::vector<size_t> efConstructionList = {100, 200};
+    std::vector<size_t> efList = {10, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+    std::string basePath;
+    std::string queryPath;
+    std::string groundTruthPath;
+    /// "bfs" or "rcm" renumbers the index with reorderIndex after the build
+    std::string reorder;
+    /// visited set of the searches: auto, epoch, bitset or hash
+    std::string visited = "auto";
+    /// threads running the queries of a search run concurrently
+    size_t threads = 1;
+};
+
+struct Dataset {
+    size_t dim = 0;
+    size_t n = 0;
+    size_t queries = 0;
+    std::vector<float> data;
+    std::vector<float> queryData;
+    /// exact neighbors of every query, closest first
+    std::vector<std::vector<hnswlib::labeltype>> truth;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::vector<float> randomVectors(size_t count, size_t dim, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<float> data(count * dim);
+    for (float &v : data) v = dist(rng);
+    return data;
+}
+
+std::vector<size_t> parseList(const std::string &value) {
+    std::vector<size_t> list;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) list.push_back(std::stoul(item));
+    }
+    if (list.empty()) throw std::invalid_argument("empty list: " + value);
+    return list;
+}
+
+/// Reads an fvecs/ivecs file, every row is an int32 dimension followed by dim values of T.
+template <typename T>
+std::vector<T> readVecs(const std::string &path, size_t &dim, size_t &rows) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input.is_open()) throw std::runtime_error("Cannot open file " + path);
+
+    std::vector<T> values;
+    dim = 0;
+    rows = 0;
+    int32_t rowDim = 0;
+    while (input.read(reinterpret_cast<char *>(&rowDim), sizeof(rowDim))) {
+        if (rowDim <= 0 || (dim != 0 && static_cast<size_t>(rowDim) != dim)) {
+            throw std::runtime_error("Invalid row dimension " + std::to_string(rowDim) + " in " + path);
+        }
+        dim = static_cast<size_t>(rowDim);
+        values.resize((rows + 1) * dim);
+        if (!input.read(reinterpret_cast<char *>(values.data() + rows * dim), dim * sizeof(T))) {
+            throw std::runtime_error("Truncated row " + std::to_string(rows) + " in " + path);
+        }
+        rows++;
+    }
+    if (rows == 0) throw std::runtime_error("No rows in " + path);
+    return values;
+}
+
+std::unique_ptr<hnswlib::SpaceInterface<float>> makeSpace(const std::string &name, size_t dim) {
+    if (name == "l2") return std::unique_ptr<hnswlib::SpaceInterface<float>>(new hnswlib::L2Space(dim));
+    if (name == "ip") return std::unique_ptr<hnswlib::SpaceInterface<float>>(new hnswlib::InnerProductSpace(dim));
+    throw std::invalid_argument("invalid space should be expected l2 or ip, name: " + name);
+}
+
+float referenceDistance(const std::string &name, const float *a, const float *b, size_t dim) {
+    float res = 0;
+    for (size_t i = 0; i < dim; i++) {
+        if (name == "l2") res += (a[i] - b[i]) * (a[i] - b[i]);
+        else res += a[i] * b[i];
+    }
+    return name == "l2" ? res : 1.0f - res;
+}
+
+/// Allows the labels divisible by modulo, 1 / modulo of the dataset.
+struct ModuloFilter : public hnswlib::BaseFilterFunctor {
+    size_t modulo;
+
+    explicit ModuloFilter(size_t modulo) : modulo(modulo) {}
+
+    bool operator()(hnswlib::labeltype label) override {
+        return label % modulo == 0;
+    }
+};
+
+/// Allows the labels in [start, end), a tenant whose labels were allocated in one block.
+struct RangeFilter : public hnswlib::BaseFilterFunctor {
+    hnswlib::labeltype start, end;
+
+    RangeFilter(hnswlib::labeltype start, hnswlib::labeltype end) : start(start), end(end) {}
+
+    bool operator()(hnswlib::labeltype label) override {
+        return label >= start && label < end;
+    }
+};
+
+/// Encodes row major float vectors with a trained SQ8Space or PQSpace, one get_data_size() block per vector.
+template <class Quantizer>
+std::vector<char> encodeVectors(const Quantizer &space, const std::vector<float> &data, size_t dim, size_t dataSize) {
+    const size_t count = data.size() / dim;
+    std::vector<char> codes(count * dataSize);
+    for (size_t i = 0; i < count; i++) {
+        space.encode(data.data() + i * dim, codes.data() + i * dataSize);
+    }
+    return codes;
+}
+
+/// Distances per second of the kernel selected by the space for dim, over a pool larger than L1.
+/// The sq8 spaces ("l2-sq8", "ip-sq8") are measured on codes of the same vectors.
+double kernelThroughput(const std::string &name, size_t dim, size_t minDistances) {
+    const bool sq8 = name == "l2-sq8" || name == "ip-sq8";
+    std::unique_ptr<hnswlib::SpaceInterface<float>> space;
+    if (sq8) space.reset(new hnswlib::SQ8Space(dim, name == "ip-sq8"));
+    else space = makeSpace(name, dim);
+    hnswlib::DISTFUNC<float> fstdistfunc = space->get_dist_func();
+    void *param = space->get_dist_func_param();
+    const size_t dataSize = space->get_data_size();
+
+    const size_t poolSize = std::max<size_t>(64, (256 * 1024) / dataSize);
+    std::vector<float> floatPool = randomVectors(poolSize, dim, 7);
+    std::vector<float> floatQuery = randomVectors(1, dim, 11);
+    std::vector<char> pool(reinterpret_cast<char *>(floatPool.data()), reinterpret_cast<char *>(floatPool.data() + floatPool.size()));
+    std::vector<char> query(reinterpret_cast<char *>(floatQuery.data()), reinterpret_cast<char *>(floatQuery.data() + floatQuery.size()));
+    if (sq8) {
+        hnswlib::SQ8Space &sq8Space = static_cast<hnswlib::SQ8Space &>(*space);
+        sq8Space.train(floatPool.data(), poolSize, false);
+        pool = encodeVectors(sq8Space, floatPool, dim, dataSize);
+        query = encodeVectors(sq8Space, floatQuery, dim, dataSize);
+    }
+
+    const size_t rounds = std::max<size_t>(1, minDistances / poolSize);
+    volatile float sink = 0;
+    Clock::time_point start = Clock::now();
+    for (size_t r = 0; r < rounds; r++) {
+        float sum = 0;
+        for (size_t i = 0; i < poolSize; i++) {
+            sum += fstdistfunc(query.data(), pool.data() + i * dataSize, param);
+        }
+        sink = sink + sum;
+    }
+    return static_cast<double>(rounds * poolSize) / secondsSince(start);
+}
+
+void computeGroundTruth(hnswlib::SpaceInterface<float> *space, Dataset &dataset, size_t k, size_t threads = 1) {
+    hnswlib::BruteforceSearch<float> bruteforce(space, dataset.n);
+    for (size_t i = 0; i < dataset.n; i++) {
+        bruteforce.addPoint(dataset.data.data() + i * dataset.dim, i);
+    }
+
+    std::vector<const void *> queries(dataset.queries);
+    for (size_t q = 0; q < dataset.queries; q++) queries[q] = dataset.queryData.data() + q * dataset.dim;
+    auto results = bruteforce.searchKnnBatch(queries, k, nullptr, threads);
+    dataset.truth.assign(dataset.queries, {});
+    for (size_t q = 0; q < dataset.queries; q++) {
+        auto &result = results[q];
+        dataset.truth[q].resize(result.size());
+        for (size_t i = result.size(); i > 0; i--) {
+            dataset.truth[q][i - 1] = result.top().second;
+            result.pop();
+        }
+    }
+}
+
+/// Random uniform vectors, or the fvecs/ivecs files given on the command line.
+Dataset loadDataset(const Options &opt) {
+    Dataset dataset;
+    if (opt.basePath.empty()) {
+        dataset.dim = opt.dim;
+        dataset.n = opt.n;
+        dataset.queries = opt.queries;
+        dataset.data = randomVectors(opt.n, opt.dim, 1);
+        dataset.queryData = randomVectors(opt.queries, opt.dim, 2);
+        return dataset;
+    }
+
+    if (opt.queryPath.empty()) throw std::invalid_argument("--base needs --query");
+    dataset.data = readVecs<float>(opt.basePath, dataset.dim, dataset.n);
+    size_t queryDim = 0;
+    dataset.queryData = readVecs<float>(opt.queryPath, queryDim, dataset.queries);
+    if (queryDim != dataset.dim) {
+        throw std::runtime_error("Query dimension " + std::to_string(queryDim) + " does not match base dimension " + std::to_string(dataset.dim));
+    }
+
+    if (!opt.groundTruthPath.empty()) {
+        size_t truthK = 0;
+        size_t truthRows = 0;
+        std::vector<int32_t> truth = readVecs<int32_t>(opt.groundTruthPath, truthK, truthRows);
+        if (truthRows != dataset.queries || truthK < opt.k) {
+            throw std::runtime_error("Ground truth must have one row of at least k neighbors per query");
+        }
+        dataset.truth.resize(dataset.queries);
+        for (size_t q = 0; q < dataset.queries; q++) {
+            dataset.truth[q].assign(truth.begin() + q * truthK, truth.begin() + q * truthK + opt.k);
+        }
+    }
+    return dataset;
+}
+
+struct SearchRun {
+    double recall;
+    double qps;
+};
+
+SearchRun runQueries(hnswlib::HierarchicalNSW<float> &index, const Dataset &dataset, size_t k, size_t ef, size_t threads = 1) {
+    index.setEf(ef);
+    std::vector<std::priority_queue<std::pair<float, hnswlib::labeltype>>> results(dataset.queries);
+    auto search = [&](size_t first) {
+        for (size_t q = first; q < dataset.queries; q += threads) {
+            results[q] = index.searchKnn(dataset.queryData.data() + q * dataset.dim, k);
+        }
+    };
+    Clock::time_point start = Clock::now();
+    if (threads <= 1) {
+        search(0);
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; t++) workers.emplace_back(search, t);
+        for (std::thread &worker : workers) worker.join();
+    }
+    const double seconds = secondsSince(start);
+
+    // recall@k is scored outside of the timed loop
+    size_t found = 0;
+    for (size_t q = 0; q < dataset.queries; q++) {
+        std::unordered_set<hnswlib::labeltype> expected(dataset.truth[q].begin(), dataset.truth[q].begin() + std::min(k, dataset.truth[q].size()));
+        while (!results[q].empty()) {
+            found += expected.count(results[q].top().second);
+            results[q].pop();
+        }
+    }
+    return {static_cast<double>(found) / static_cast<double>(dataset.queries * k), static_cast<double>(dataset.queries) / seconds};
+}
+
+std::unique_ptr<hnswlib::HierarchicalNSW<float>> buildIndex(hnswlib::SpaceInterface<float> *space, const Dataset &dataset,
+                                                            size_t M, size_t efConstruction, double &buildSeconds) {
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> index(new hnswlib::HierarchicalNSW<float>(space, dataset.n, M, efConstruction));
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < dataset.n; i++) {
+        index->addPoint(dataset.data.data() + i * dataset.dim, i);
+    }
+    buildSeconds = secondsSince(start);
+    return index;
+}
+
+/// Applies --reorder, returns the seconds it took (0 without --reorder)
+double reorderIndex(hnswlib::HierarchicalNSW<float> &index, const std::string &name) {
+    if (name.empty()) return 0;
+    if (name != "bfs" && name != "rcm") throw std::invalid_argument("unknown reorder method " + name);
+    Clock::time_point start = Clock::now();
+    index.reorderIndex(name == "bfs" ? hnswlib::HierarchicalNSW<float>::REORDER_BFS : hnswlib::HierarchicalNSW<float>::REORDER_RCM);
+    return secondsSince(start);
+}
+
+hnswlib::VisitedSetKind parseVisitedSet(const std::string &name) {
+    if (name == "auto") return hnswlib::VISITED_AUTO;
+    if (name == "epoch") return hnswlib::VISITED_EPOCH;
+    if (name == "bitset") return hnswlib::VISITED_BITSET;
+    if (name == "hash") return hnswlib::VISITED_HASH;
+    throw std::invalid_argument("unknown visited set " + name);
+}
+
+/// Results of every query, closest first
+std::vector<std::vector<std::pair<float, hnswlib::labeltype>>> searchAll(const hnswlib::HierarchicalNSW<float> &index, const Dataset &dataset, size_t k) {
+    std::vector<std::vector<std::pair<float, hnswlib::labeltype>>> results(dataset.queries);
+    for (size_t q = 0; q < dataset.queries; q++) {
+        results[q] = index.searchKnnCloserFirst(dataset.queryData.data() + q * dataset.dim, k);
+    }
+    return results;
+}
+
+int runSmoke() {
+    int failures = 0;
+
+    // every kernel branch (16/4 multiples, residuals, short vectors) against the scalar reference
+    for (const std::string name : {"l2", "ip"}) {
+        for (size_t dim = 1; dim <= 70; dim++) {
+            std::unique_ptr<hnswlib::SpaceInterface<float>> space = makeSpace(name, dim);
+            std::vector<float> v = randomVectors(2, dim, static_cast<unsigned>(dim));
+            const float expected = referenceDistance(name, v.data(), v.data() + dim, dim);
+            const float actual = space->get_dist_func()(v.data(), v.data() + dim, space->get_dist_func_param());
+            if (std::fabs(expected - actual) > 1e-4f * std::max(1.0f, std::fabs(expected))) {
+                printf("FAIL kernel %s dim %zu: expected %f, got %f\n", name.c_str(), dim, expected, actual);
+                failures++;
+            }
+        }
+    }
+
+    // batch kernels (blocks of four and the leftover vectors) against the scalar reference
+    for (const std::string name : {"l2", "ip"}) {
+        for (size_t dim = 1; dim <= 70; dim++) {
+            std::unique_ptr<hnswlib::SpaceInterface<float>> space = makeSpace(name, dim);
+            const size_t count = 7;
+            std::vector<float> v = randomVectors(count + 1, dim, static_cast<unsigned>(dim) + 2);
+            std::vector<const void *> vectors(count);
+            for (size_t i = 0; i < count; i++) vectors[i] = v.data() + (i + 1) * dim;
+            std::vector<float> actual(count);
+            space->get_batch_query_dist_func()(v.data(), vectors.data(), count, space->get_dist_func_param(), actual.data());
+            for (size_t i = 0; i < count; i++) {
+                const float expected = referenceDistance(name, v.data(), v.data() + (i + 1) * dim, dim);
+                if (std::fabs(expected - actual[i]) > 1e-4f * std::max(1.0f, std::fabs(expected))) {
+                    printf("FAIL batch kernel %s dim %zu vector %zu: expected %f, got %f\n", name.c_str(), dim, i, expected, actual[i]);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    // sq8 code kernels against the scalar loops, and the symmetric distance against the decoded vectors
+    for (size_t dim = 1; dim <= 70; dim++) {
+        std::mt19937 rng(static_cast<unsigned>(dim));
+        std::vector<uint8_t> a(dim), b(dim);
+        for (size_t i = 0; i < dim; i++) {
+            a[i] = static_cast<uint8_t>(rng());
+            b[i] = static_cast<uint8_t>(rng());
+        }
+        if (hnswlib::SQ8L2SqrCodesSIMD(a.data(), b.data(), dim) != hnswlib::SQ8L2SqrCodes(a.data(), b.data(), dim) ||
+            hnswlib::SQ8DotCodesSIMD(a.data(), b.data(), dim) != hnswlib::SQ8DotCodes(a.data(), b.data(), dim)) {
+            printf("FAIL sq8 code kernel dim %zu\n", dim);
+            failures++;
+        }
+
+        for (const std::string name : {"l2", "ip"}) {
+            for (bool perDimension : {false, true}) {
+                hnswlib::SQ8Space space(dim, name == "ip");
+                std::vector<float> v = randomVectors(16, dim, static_cast<unsigned>(dim) + 1);
+                space.train(v.data(), 16, perDimension);
+                std::vector<char> codes = encodeVectors(space, v, dim, space.get_data_size());
+                std::vector<float> decoded(2 * dim);
+                space.decode(codes.data(), decoded.data());
+                space.decode(codes.data() + space.get_data_size(), decoded.data() + dim);
+                const float expected = referenceDistance(name, decoded.data(), decoded.data() + dim, dim);
+                const float actual = space.get_dist_func()(codes.data(), codes.data() + space.get_data_size(), space.get_dist_func_param());
+                if (std::fabs(expected - actual) > 1e-3f * std::max(1.0f, std::fabs(expected))) {
+                    printf("FAIL sq8 %s%s dim %zu: expected %f, got %f\n", name.c_str(), perDimension ? " per dimension" : "", dim, expected, actual);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    // pq query table and symmetric distances against the decoded vectors
+    for (size_t dim : {4, 12, 32}) {
+        for (size_t M : {dim / 4, dim / 2, dim}) {
+            for (const std::string name : {"l2", "ip"}) {
+                hnswlib::PQSpace space(dim, name == "ip");
+                std::vector<float> v = randomVectors(300, dim, static_cast<unsigned>(dim + M));
+                space.train(v.data(), 300, M, 4);
+                std::vector<char> codes = encodeVectors(space, v, dim, space.get_data_size());
+                std::vector<float> decoded(2 * dim), table(space.getQueryTableSize());
+                space.decode(codes.data(), decoded.data());
+                space.decode(codes.data() + space.get_data_size(), decoded.data() + dim);
+                space.computeQueryTable(v.data(), table.data());
+
+                const float expectedAdc = referenceDistance(name, v.data(), decoded.data() + dim, dim);
+                const float actualAdc = space.get_query_dist_func()(table.data(), codes.data() + space.get_data_size(), space.get_dist_func_param());
+                const float expected = referenceDistance(name, decoded.data(), decoded.data() + dim, dim);
+                const float actual = space.get_dist_func()(codes.data(), codes.data() + space.get_data_size(), space.get_dist_func_param());
+                if (std::fabs(expectedAdc - actualAdc) > 1e-3f * std::max(1.0f, std::fabs(expectedAdc)) ||
+                    std::fabs(expected - actual) > 1e-3f * std::max(1.0f, std::fabs(expected))) {
+                    printf("FAIL pq %s dim %zu M %zu: expected %f/%f, got %f/%f\n", name.c_str(), dim, M, expectedAdc, expected, actualAdc, actual);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    Options opt;
+    opt.dim = 32;
+    opt.n = 2000;
+    opt.queries = 100;
+    Dataset dataset = loadDataset(opt);
+    std::unique_ptr<hnswlib::SpaceInterface<float>> space = makeSpace(opt.space, dataset.dim);
+    computeGroundTruth(space.get(), dataset, opt.k);
+
+    double buildSeconds = 0;
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> index = buildIndex(space.get(), dataset, opt.M, opt.efConstruction, buildSeconds);
+    SearchRun run = runQueries(*index, dataset, opt.k, 100);
+    if (run.recall < 0.9) {
+        printf("FAIL recall@%zu at ef 100: %.3f\n", opt.k, run.recall);
+        failures++;
+    }
+
+    // filtered searches against the exact filtered neighbors: selective filters are answered by the scan of
+    // the allowed elements, without the fallback the graph search still finds most of them
+    for (size_t modulo : {100, 4}) {
+        ModuloFilter filter(modulo);
+        for (bool fallback : {true, false}) {
+            index->setFilterFallback(fallback);
+            index->setEf(100);
+            size_t found = 0, total = 0;
+            for (size_t q = 0; q < dataset.queries; q++) {
+                const float *query = dataset.queryData.data() + q * dataset.dim;
+                std::vector<std::pair<float, hnswlib::labeltype>> allowed;
+                for (size_t i = 0; i < dataset.n; i += modulo) {
+                    allowed.emplace_back(referenceDistance(opt.space, query, dataset.data.data() + i * dataset.dim, dataset.dim), i);
+                }
+                const size_t count = std::min(opt.k, allowed.size());
+                std::partial_sort(allowed.begin(), allowed.begin() + count, allowed.end());
+                std::unordered_set<hnswlib::labeltype> expected;
+                for (size_t i = 0; i < count; i++) expected.insert(allowed[i].second);
+                auto result = index->searchKnn(query, opt.k, &filter);
+                if (result.size() != count) {
+                    printf("FAIL filtered search, 1/%zu allowed, fallback %d: %zu results, expected %zu\n", modulo, fallback,
+                           result.size(), count);
+                    failures++;
+                }
+                for (; !result.empty(); result.pop()) found += expected.count(result.top().second);
+                total += count;
+            }
+            const double recall = static_cast<double>(found) / static_cast<double>(total);
+            if (recall < (fallback ? 0.99 : 0.8)) {
+                printf("FAIL filtered recall@%zu, 1/%zu allowed, fallback %d: %.3f\n", opt.k, modulo, fallback, recall);
+                failures++;
+            }
+        }
+    }
+    index->setFilterFallback(true);
+
+    // the selectivity estimate of a block of labels is unbiased over the seeds, the sample does not line up with
+    // the block, and repeated estimates with the default seed agree
+    {
+        RangeFilter block(1000, 1020);
+        double estimated = 0;
+        for (uint32_t seed = 1; seed <= 200; seed++) estimated += static_cast<double>(index->estimateAllowedCount(&block, seed));
+        estimated /= 200;
+        if (estimated < 15 || estimated > 25) {
+            printf("FAIL selectivity estimate of 20 labels in a block: %.1f\n", estimated);
+            failures++;
+        }
+        if (index->estimateAllowedCount(&block) != index->estimateAllowedCount(&block)) {
+            printf("FAIL repeated selectivity estimates differ\n");
+            failures++;
+        }
+    }
+
+    // a renumbered graph is the same graph, searches return the same neighbors and distances
+    for (const std::string method : {"bfs", "rcm"}) {
+        std::unique_ptr<hnswlib::HierarchicalNSW<float>> reordered = buildIndex(space.get(), dataset, opt.M, opt.efConstruction, buildSeconds);
+        reordered->markDelete(3);
+        index->markDelete(3);
+        reorderIndex(*reordered, method);
+        reordered->setEf(50);
+        index->setEf(50);
+        bool same = reordered->label_lookup_.size() == dataset.n && reordered->getLabels(true) == std::vector<hnswlib::labeltype>{3} &&
+            searchAll(*reordered, dataset, opt.k) == searchAll(*index, dataset, opt.k);
+        index->unmarkDelete(3);
+        if (!same) {
+            printf("FAIL %s reordered index returns different results\n", method.c_str());
+            failures++;
+        }
+    }
+
+    // the visited sets only change how visits are recorded, never which elements a search visits
+    {
+        std::vector<std::vector<std::pair<float, hnswlib::labeltype>>> expected = searchAll(*index, dataset, opt.k);
+        for (const std::string name : {"epoch", "bitset", "hash"}) {
+            index->setVisitedSetKind(parseVisitedSet(name));
+            for (int repeat = 0; repeat < 2; repeat++) {
+                if (searchAll(*index, dataset, opt.k) != expected) {
+                    printf("FAIL %s visited set returns different results\n", name.c_str());
+                    failures++;
+                }
+            }
+        }
+        index->setVisitedSetKind(hnswlib::VISITED_AUTO);
+
+        // concurrent searches share the pool, through the per thread slots and the locked free lists
+        for (const std::string name : {"epoch", "bitset", "hash"}) {
+            index->setVisitedSetKind(parseVisitedSet(name));
+            std::vector<std::vector<std::vector<std::pair<float, hnswlib::labeltype>>>> concurrent(4);
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < concurrent.size(); t++) {
+                workers.emplace_back([&, t]() { concurrent[t] = searchAll(*index, dataset, opt.k); });
+            }
+            for (std::thread &worker : workers) worker.join();
+            for (size_t t = 0; t < concurrent.size(); t++) {
+                if (concurrent[t] != expected) {
+                    printf("FAIL concurrent %s search %zu returns different results\n", name.c_str(), t);
+                    failures++;
+                }
+            }
+        }
+        index->setVisitedSetKind(hnswlib::VISITED_AUTO);
+
+        // a hash set sized for a few visits grows and keeps its table, resets drop the previous visits
+        hnswlib::VisitedHashSet hash(0);
+        hnswlib::VisitedBitset bitset(5000);
+        size_t grownCapacity = 0;
+        for (int round = 0; round < 2; round++) {
+            hash.reset(4);
+            bitset.reset(4);
+            bool ok = round == 0 || hash.capacity() == grownCapacity;
+            for (unsigned int id = 0; id < 5000; id += 3) ok = ok && hash.visit(id) && bitset.visit(id);
+            for (unsigned int id = 0; id < 5000; id++) ok = ok && hash.visit(id) == (id % 3 != 0) && bitset.visit(id) == (id % 3 != 0);
+            if (!ok) {
+                printf("FAIL visited hash set or bitset round %d\n", round);
+                failures++;
+            }
+            grownCapacity = hash.capacity();
+        }
+
+        // epoch arrays up to MAX_EPOCH_ELEMENTS, above it a hash set for small searches and a bitset for large ones
+        hnswlib::VisitedListPool smallPool(0, 60000), largePool(0, 1 << 20);
+        if (smallPool.chooseVisitedSet(10 * 32) != hnswlib::VISITED_EPOCH ||
+            largePool.chooseVisitedSet(10 * 32) != hnswlib::VISITED_HASH ||
+            largePool.chooseVisitedSet(1000 * 32) != hnswlib::VISITED_BITSET) {
+            printf("FAIL chooseVisitedSet by index size and expected visits\n");
+            failures++;
+        }
+    }
+
+    if (hnswlib::crc32Update(0, "123456789", 9) != 0xCBF43926u) {
+        printf("FAIL crc32 check value\n");
+        failures++;
+    }
+
+    // the flat label map against std::unordered_map, through growth and backward shift erases
+    {
+        hnswlib::LabelMap labels;
+        std::unordered_map<hnswlib::labeltype, hnswlib::tableint> expected;
+        std::mt19937 rng(7);
+        for (hnswlib::tableint i = 0; i < 20000; i++) {
+            hnswlib::labeltype label = rng() % 5000;
+            if (rng() % 3 == 0) {
+                if (labels.erase(label) != expected.erase(label)) break;
+            } else {
+                labels.assign(label, i);
+                expected[label] = i;
+            }
+        }
+        bool same = labels.size() == expected.size();
+        for (const auto &entry : expected) {
+            auto found = labels.find(entry.first);
+            same = same && found != labels.end() && found->second == entry.second;
+        }
+        if (!same) {
+            printf("FAIL label map differs from std::unordered_map\n");
+            failures++;
+        }
+    }
+
+    // snapshot, then a delta with a few more points (after a resize) and delete marks, replayed on the snapshot
+    {
+        const std::string snapshotPath = "hnswlib_bench_smoke.bin";
+        const std::string deltaPath = snapshotPath + ".delta";
+        const size_t snapshotCount = dataset.n - 20;
+        hnswlib::HierarchicalNSW<float> original(space.get(), snapshotCount, opt.M, opt.efConstruction);
+        for (size_t i = 0; i < snapshotCount; i++) original.addPoint(dataset.data.data() + i * dataset.dim, i);
+        original.saveIndex(snapshotPath);
+        original.setDirtyTracking(true);
+        original.resizeIndex(dataset.n);
+        for (size_t i = snapshotCount; i < dataset.n; i++) original.addPoint(dataset.data.data() + i * dataset.dim, i);
+        for (size_t i = 0; i < dataset.n; i += 50) original.markDelete(i);
+        const size_t dirtyCount = original.getDirtyCount();
+        original.saveDelta(deltaPath);
+
+        hnswlib::HierarchicalNSW<float> restored(space.get(), snapshotPath);
+        // a truncated or bit flipped delta, one of another version or one with a valid checksum but a neighbor
+        // id past the elements is rejected before it touches the index
+        {
+            std::ifstream deltaFile(deltaPath, std::ios::binary);
+            std::string bytes((std::istreambuf_iterator<char>(deltaFile)), std::istreambuf_iterator<char>());
+            deltaFile.close();
+            std::string flipped = bytes;
+            flipped[flipped.size() / 2] ^= 0x10;
+            // the level0 list of the first record, after the 20 byte header, the 40 byte body header and the record id
+            std::string badNeighbor = bytes;
+            const size_t listOffset = 20 + 40 + sizeof(hnswlib::tableint) + original.offsetLevel0_;
+            const unsigned short one = 1;
+            const hnswlib::tableint farId = static_cast<hnswlib::tableint>(dataset.n + 5);
+            memcpy(&badNeighbor[listOffset], &one, sizeof(one));
+            memcpy(&badNeighbor[listOffset + sizeof(hnswlib::linklistsizeint)], &farId, sizeof(farId));
+            const uint32_t crc = hnswlib::crc32Update(0, badNeighbor.data() + 20, badNeighbor.size() - 20);
+            memcpy(&badNeighbor[16], &crc, sizeof(crc));
+            // a delta of another format version
+            std::string newerVersion = bytes;
+            newerVersion[8]++;
+            const std::string level0(restored.data_level0_memory_, snapshotCount * restored.size_data_per_element_);
+            for (const std::string &damaged : {bytes.substr(0, bytes.size() - 3), flipped, badNeighbor, newerVersion}) {
+                std::ofstream(deltaPath, std::ios::binary | std::ios::trunc) << damaged;
+                try {
+                    restored.loadDelta(deltaPath);
+                    printf("FAIL loadDelta accepted a damaged delta of %zu bytes\n", damaged.size());
+                    failures++;
+                } catch (const std::runtime_error &) {
+                }
+                if (restored.cur_element_count != snapshotCount || restored.num_deleted_ != 0 ||
+                    memcmp(restored.data_level0_memory_, level0.data(), level0.size()) != 0) {
+                    printf("FAIL a rejected delta changed the index\n");
+                    failures++;
+                }
+            }
+            std::ofstream(deltaPath, std::ios::binary | std::ios::trunc) << bytes;
+        }
+        restored.loadDelta(deltaPath);
+        bool same = restored.cur_element_count == original.cur_element_count && restored.num_deleted_ == original.num_deleted_ &&
+            restored.enterpoint_node_ == original.enterpoint_node_ && restored.maxlevel_ == original.maxlevel_ &&
+            memcmp(restored.data_level0_memory_, original.data_level0_memory_, original.cur_element_count * original.size_data_per_element_) == 0;
+        for (size_t i = 0; same && i < original.cur_element_count; i++) {
+            same = restored.element_levels_[i] == original.element_levels_[i] &&
+                (original.element_levels_[i] == 0 ||
+                 memcmp(restored.linkLists_[i], original.linkLists_[i], original.size_links_per_element_ * original.element_levels_[i]) == 0);
+        }
+        // the new points, their neighbors and the deleted ones, far fewer than the index holds
+        if (!same || dirtyCount * 4 >= dataset.n) {
+            printf("FAIL index delta: %zu dirty elements, restored index %s\n", dirtyCount, same ? "matches" : "differs");
+            failures++;
+        }
+        // the label lookup and the delete marks come back from the labels and deleted sections
+        original.saveIndex(snapshotPath);
+        {
+            hnswlib::HierarchicalNSW<float> reloaded(space.get(), snapshotPath, false, 0, true);
+            if (reloaded.label_lookup_ != original.label_lookup_ || reloaded.num_deleted_ != original.num_deleted_ ||
+                reloaded.deleted_elements.size() != original.num_deleted_ || reloaded.getLabels(true) != original.getLabels(true)) {
+                printf("FAIL reloaded labels or delete marks differ\n");
+                failures++;
+            }
+        }
+        // a truncated, padded or bit flipped file is rejected instead of read past its end or loaded as is
+        std::ifstream snapshot(snapshotPath, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(snapshot)), std::istreambuf_iterator<char>());
+        std::string flipped = bytes;
+        flipped[flipped.size() / 2] ^= 0x10;
+        for (const std::string &damaged : {bytes.substr(0, bytes.size() - 3), bytes + std::string(4, '\0'), flipped}) {
+            std::ofstream(snapshotPath, std::ios::binary | std::ios::trunc) << damaged;
+            try {
+                hnswlib::HierarchicalNSW<float> broken(space.get(), snapshotPath);
+                printf("FAIL loadIndex accepted a damaged file of %zu bytes\n", damaged.size());
+                failures++;
+            } catch (const std::runtime_error &) {
+            }
+        }
+        // fewer labels than elements is a valid state, a label pointing at the element of another label is not
+        original.label_lookup_.erase(1);
+        original.saveIndex(snapshotPath);
+        try {
+            hnswlib::HierarchicalNSW<float> reloaded(space.get(), snapshotPath);
+            if (reloaded.label_lookup_ != original.label_lookup_) {
+                printf("FAIL reloaded label lookup differs after a label was dropped\n");
+                failures++;
+            }
+        } catch (const std::runtime_error &e) {
+            printf("FAIL loadIndex rejected an index with fewer labels than elements: %s\n", e.what());
+            failures++;
+        }
+        original.label_lookup_.assign(1, 2);
+        original.saveIndex(snapshotPath);
+        try {
+            hnswlib::HierarchicalNSW<float> broken(space.get(), snapshotPath);
+            printf("FAIL loadIndex accepted a label lookup entry pointing at another label\n");
+            failures++;
+        } catch (const std::runtime_error &) {
+        }
+        std::remove(snapshotPath.c_str());
+        std::remove(deltaPath.c_str());
+    }
+
+    // graph over sq8 codes, scored against the float ground truth
+    hnswlib::SQ8Space sq8Space(dataset.dim, false);
+    sq8Space.train(dataset.data.data(), dataset.n, false);
+    std::vector<char> codes = encodeVectors(sq8Space, dataset.data, dataset.dim, sq8Space.get_data_size());
+    std::vector<char> queryCodes = encodeVectors(sq8Space, dataset.queryData, dataset.dim, sq8Space.get_data_size());
+    hnswlib::HierarchicalNSW<float> sq8Index(&sq8Space, dataset.n, opt.M, opt.efConstruction);
+    for (size_t i = 0; i < dataset.n; i++) {
+        sq8Index.addPoint(codes.data() + i * sq8Space.get_data_size(), i);
+    }
+    size_t found = 0;
+    sq8Index.setEf(100);
+    for (size_t q = 0; q < dataset.queries; q++) {
+        auto result = sq8Index.searchKnn(queryCodes.data() + q * sq8Space.get_data_size(), opt.k);
+        std::unordered_set<hnswlib::labeltype> expected(dataset.truth[q].begin(), dataset.truth[q].end());
+        for (; !result.empty(); result.pop()) found += expected.count(result.top().second);
+    }
+    const double sq8Recall = static_cast<double>(found) / static_cast<double>(dataset.queries * opt.k);
+    if (sq8Recall < 0.8) {
+        printf("FAIL sq8 recall@%zu at ef 100: %.3f\n", opt.k, sq8Recall);
+        failures++;
+    }
+
+    // graph and brute force scan over pq codes, searched with query tables
+    hnswlib::PQSpace pqSpace(dataset.dim, false);
+    pqSpace.train(dataset.data.data(), dataset.n, dataset.dim / 2, 10);
+    std::vector<char> pqCodes = encodeVectors(pqSpace, dataset.data, dataset.dim, pqSpace.get_data_size());
+    hnswlib::HierarchicalNSW<float> pqIndex(&pqSpace, dataset.n, opt.M, opt.efConstruction);
+    hnswlib::BruteforceSearch<float> pqScan(&pqSpace, dataset.n);
+    for (size_t i = 0; i < dataset.n; i++) {
+        pqIndex.addPoint(pqCodes.data() + i * pqSpace.get_data_size(), i);
+        pqScan.addPoint(pqCodes.data() + i * pqSpace.get_data_size(), i);
+    }
+    size_t pqFound = 0, pqScanFound = 0;
+    std::vector<float> table(pqSpace.getQueryTableSize());
+    pqIndex.setEf(100);
+    for (size_t q = 0; q < dataset.queries; q++) {
+        pqSpace.computeQueryTable(dataset.queryData.data() + q * dataset.dim, table.data());
+        std::unordered_set<hnswlib::labeltype> expected(dataset.truth[q].begin(), dataset.truth[q].end());
+        auto result = pqIndex.searchKnn(table.data(), opt.k);
+        for (; !result.empty(); result.pop()) pqFound += expected.count(result.top().second);
+        auto scanResult = pqScan.searchKnn(table.data(), opt.k);
+        for (; !scanResult.empty(); scanResult.pop()) pqScanFound += expected.count(scanResult.top().second);
+    }
+    const double pqRecall = static_cast<double>(pqFound) / static_cast<double>(dataset.queries * opt.k);
+    const double pqScanRecall = static_cast<double>(pqScanFound) / static_cast<double>(dataset.queries * opt.k);
+    if (pqRecall < 0.75 || pqScanRecall < 0.75) {
+        printf("FAIL pq recall@%zu at ef 100: hnsw %.3f, brute force %.3f\n", opt.k, pqRecall, pqScanRecall);
+        failures++;
+    }
+
+    // brute force: tiles, thread slices and query batches return the exact k nearest, k beyond the size is clamped
+    {
+        const size_t scanDim = 4, scanN = 40000, scanQueries = 20, scanK = 10;
+        std::unique_ptr<hnswlib::SpaceInterface<float>> scanSpace = makeSpace("l2", scanDim);
+        std::vector<float> scanData = randomVectors(scanN, scanDim, 11);
+        std::vector<float> scanQueryData = randomVectors(scanQueries, scanDim, 12);
+        hnswlib::BruteforceSearch<float> scan(scanSpace.get(), scanN);
+        for (size_t i = 0; i < scanN; i++) scan.addPoint(scanData.data() + i * scanDim, i);
+
+        std::vector<const void *> queries(scanQueries);
+        for (size_t q = 0; q < scanQueries; q++) queries[q] = scanQueryData.data() + q * scanDim;
+        auto batch = scan.searchKnnBatch(queries, scanK, nullptr, 4);
+        for (size_t q = 0; q < scanQueries; q++) {
+            std::vector<std::pair<float, hnswlib::labeltype>> expected(scanN);
+            for (size_t i = 0; i < scanN; i++) {
+                expected[i] = {referenceDistance("l2", scanQueryData.data() + q * scanDim, scanData.data() + i * scanDim, scanDim), i};
+            }
+            std::partial_sort(expected.begin(), expected.begin() + scanK, expected.end());
+            expected.resize(scanK);
+
+            auto serial = scan.searchKnn(queries[q], scanK);
+            auto parallel = scan.searchKnn(queries[q], scanK, nullptr, 4);
+            for (size_t i = scanK; i > 0; i--) {
+                if (serial.size() != i || parallel.size() != i || batch[q].size() != i ||
+                    serial.top() != parallel.top() || serial.top() != batch[q].top() ||
+                    std::fabs(serial.top().first - expected[i - 1].first) > 1e-5f) {
+                    printf("FAIL brute force query %zu: results differ from the exact scan at rank %zu\n", q, i - 1);
+                    failures++;
+                    break;
+                }
+                serial.pop();
+                parallel.pop();
+                batch[q].pop();
+            }
+        }
+
+        hnswlib::BruteforceSearch<float> small(scanSpace.get(), 100);
+        for (size_t i = 0; i < 5; i++) small.addPoint(scanData.data() + i * scanDim, i);
+        if (small.searchKnn(queries[0], 50).size() != 5) {
+            printf("FAIL brute force k 50 over 5 elements\n");
+            failures++;
+        }
+    }
+
+    // replacing deleted elements: a deleted label takes its own element back, no label drops out of the lookup
+    {
+        hnswlib::HierarchicalNSW<float> replaceIndex(space.get(), 100, opt.M, opt.efConstruction, 100, true);
+        for (size_t i = 0; i < 50; i++) replaceIndex.addPoint(dataset.data.data() + i * dataset.dim, i);
+        replaceIndex.markDelete(3);
+        replaceIndex.markDelete(7);
+        const hnswlib::labeltype replaced[] = {7, 3, 50};
+        for (size_t i = 0; i < 3; i++) replaceIndex.addPoint(dataset.data.data() + (60 + i) * dataset.dim, replaced[i], true);
+        for (size_t i = 0; i < 3; i++) {
+            if (replaceIndex.label_lookup_.count(replaced[i]) == 0 ||
+                replaceIndex.getDataByLabel<float>(replaced[i])[0] != dataset.data[(60 + i) * dataset.dim]) {
+                printf("FAIL replace deleted: label %zu lost\n", static_cast<size_t>(replaced[i]));
+                failures++;
+            }
+        }
+        if (replaceIndex.label_lookup_.size() != replaceIndex.cur_element_count) {
+            printf("FAIL replace deleted: %zu labels for %zu elements\n", replaceIndex.label_lookup_.size(),
+                   static_cast<size_t>(replaceIndex.cur_element_count));
+            failures++;
+        }
+    }
+
+    printf("%s: %d failures\n", failures == 0 ? "OK" : "FAILED", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int runBench(const Options &opt) {
+    printf("# distance kernels (%s)\n", opt.space.c_str());
+    printf("%8s %16s %12s\n", "dim", "Mdist/s", "GFLOP/s");
+    for (size_t dim : {4, 16, 17, 32, 64, 128, 256, 384, 768, 1536}) {
+        const double perSecond = kernelThroughput(opt.space, dim, 4000000);
+        printf("%8zu %16.1f %12.2f\n", dim, perSecond / 1e6, perSecond * 2.0 * static_cast<double>(dim) / 1e9);
+    }
+
+    const std::string sq8Name = opt.space + "-sq8";
+    printf("\n# distance kernels (%s)\n", sq8Name.c_str());
+    printf("%8s %16s\n", "dim", "Mdist/s");
+    for (size_t dim : {4, 16, 17, 32, 64, 128, 256, 384, 768, 1536}) {
+        printf("%8zu %16.1f\n", dim, kernelThroughput(sq8Name, dim, 4000000) / 1e6);
+    }
+
+    Dataset dataset = loadDataset(opt);
+    std::unique_ptr<hnswlib::SpaceInterface<float>> space = makeSpace(opt.space, dataset.dim);
+    if (dataset.truth.empty()) computeGroundTruth(space.get(), dataset, opt.k, opt.threads);
+
+    printf("\n# build (n %zu, dim %zu, M %zu, efConstruction %zu)\n", dataset.n, dataset.dim, opt.M, opt.efConstruction);
+    double buildSeconds = 0;
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> index = buildIndex(space.get(), dataset, opt.M, opt.efConstruction, buildSeconds);
+    index->setVisitedSetKind(parseVisitedSet(opt.visited));
+    printf("%.3f s, %.0f points/s\n", buildSeconds, static_cast<double>(dataset.n) / buildSeconds);
+    if (!opt.reorder.empty()) {
+        printf("reorder %s: %.3f s\n", opt.reorder.c_str(), reorderIndex(*index, opt.reorder));
+    }
+
+    printf("\n# search (k %zu, %zu queries, %zu threads, target recall %.3f)\n", opt.k, dataset.queries, opt.threads, opt.recall);
+    printf("%8s %10s %12s\n", "ef", "recall", "QPS");
+    for (size_t ef : opt.efList) {
+        if (ef < opt.k) continue;
+        SearchRun run = runQueries(*index, dataset, opt.k, ef, opt.threads);
+        printf("%8zu %10.4f %12.0f\n", ef, run.recall, run.qps);
+        if (run.recall >= opt.recall) {
+            printf("QPS at recall %.3f: %.0f (ef %zu)\n", opt.recall, run.qps, ef);
+            return EXIT_SUCCESS;
+        }
+    }
+    printf("target recall %.3f not reached\n", opt.recall);
+    return EXIT_SUCCESS;
+}
+
+int runSweep(const Options &opt) {
+    Dataset dataset = loadDataset(opt);
+    std::unique_ptr<hnswlib::SpaceInterface<float>> space = makeSpace(opt.space, dataset.dim);
+    if (dataset.truth.empty()) computeGroundTruth(space.get(), dataset, opt.k, opt.threads);
+
+    printf("# sweep (%s, n %zu, dim %zu, %zu queries, recall@%zu)\n", opt.space.c_str(), dataset.n, dataset.dim, dataset.queries, opt.k);
+    printf("M,efConstruction,buildSeconds,efSearch,recall,qps\n");
+    for (size_t M : opt.MList) {
+        for (size_t efConstruction : opt.efConstructionList) {
+            double buildSeconds = 0;
+            std::unique_ptr<hnswlib::HierarchicalNSW<float>> index = buildIndex(space.get(), dataset, M, efConstruction, buildSeconds);
+            reorderIndex(*index, opt.reorder);
+            index->setVisitedSetKind(parseVisitedSet(opt.visited));
+            for (size_t ef : opt.efList) {
+                if (ef < opt.k) continue;
+                SearchRun run = runQueries(*index, dataset, opt.k, ef, opt.threads);
+                printf("%zu,%zu,%.3f,%zu,%.4f,%.0f\n", M, efConstruction, buildSeconds, ef, run.recall, run.qps);
+            }
+            fflush(stdout);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options opt;
+    try {
+        for (int i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            auto next = [&]() -> std::string {
+                if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+                return argv[++i];
+            };
+            if (arg == "--smoke") opt.smoke = true;
+            else if (arg == "--space") opt.space = next();
+            else if (arg == "--dim") opt.dim = std::stoul(next());
+            else if (arg == "--n") opt.n = std::stoul(next());
+            else if (arg == "--queries") opt.queries = std::stoul(next());
+            else if (arg == "--k") opt.k = std::stoul(next());
+            else if (arg == "--M") opt.M = std::stoul(next());
+            else if (arg == "--ef-construction") opt.efConstruction = std::stoul(next());
+            else if (arg == "--recall") opt.recall = std::stod(next());
+            else if (arg == "--sweep") opt.sweep = true;
+            else if (arg == "--M-list") opt.MList = parseList(next());
+            else if (arg == "--ef-construction-list") opt.efConstructionList = parseList(next());
+            else if (arg == "--ef-list") opt.efList = parseList(next());
+            else if (arg == "--base") opt.basePath = next();
+            else if (arg == "--query") opt.queryPath = next();
+            else if (arg == "--groundtruth") opt.groundTruthPath = next();
+            else if (arg == "--reorder") opt.reorder = next();
+            else if (arg == "--visited") opt.visited = next();
+            else if (arg == "--threads") opt.threads = std::stoul(next());
+            else throw std::invalid_argument("unknown argument " + arg);
+        }
+        if (opt.smoke) return runSmoke();
+        return opt.sweep ? runSweep(opt) : runBench(opt);
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "hnswlib_bench: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
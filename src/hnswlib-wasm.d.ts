@@ -38,6 +38,21 @@ type Double = number;
 /** Distance for search index. `l2`: sum((x_i - y_i)^2), `ip`: 1 - sum(x_i * y_i), `cosine`: 1 - sum(x_i * y_i) / norm(x) * norm(y). */
 export type SpaceName = 'l2' | 'ip' | 'cosine';
 
+/**
+ * Product quantization variants of the spaces. Every vector is stored as `numSubvectors` bytes, the index of the nearest trained centroid
+ * of each subvector, and queries are compared through a lookup table. They need `trainProductQuantizer` before `initIndex`.
+ */
+export type ProductQuantizedSpaceName = 'l2-pq' | 'ip-pq' | 'cosine-pq';
+
+/** Metric spaces of {@link BruteforceSearch}. */
+export type BruteforceSearchSpaceName = SpaceName | ProductQuantizedSpaceName;
+
+/**
+ * Metric spaces of {@link HierarchicalNSW}. The `-sq8` variants store every dimension as an 8 bit code instead of a float (4x less memory),
+ * they need `trainQuantizer` before points are added. The `-pq` variants are described in {@link ProductQuantizedSpaceName}.
+ */
+export type HierarchicalNSWSpaceName = SpaceName | 'l2-sq8' | 'ip-sq8' | 'cosine-sq8' | ProductQuantizedSpaceName;
+
 /** Searh result object. */
 export interface SearchResult {
   /** The disances of the nearest negihbors found. */
@@ -46,9 +61,77 @@ export interface SearchResult {
   neighbors: number[];
 }
 
+export interface BatchSearchResult {
+  /** The distances of the nearest neighbors found, `numNeighbors` per query (row major). */
+  distances: Float32Array;
+  /** The indices of the nearest neighbors found, `numNeighbors` per query (row major). */
+  neighbors: Uint32Array;
+}
+
 /** Function for filtering elements by its labels. */
 export type FilterFunction = (label: number) => boolean;
 
+/**
+ * Base class of the native label filters. They are evaluated in wasm for every candidate, unlike a {@link FilterFunction}
+ * which is called back in JS. An allow list accepts only the labels it contains, a deny list every label except those.
+ * Build them once and reuse them across queries, call `delete()` when they are no longer needed.
+ */
+export class LabelFilter {
+  /**
+   * checks a label against the filter.
+   * @param {number} label The label to check.
+   * @return {boolean} true if the search accepts the label.
+   */
+  isAllowed(label: number): boolean;
+  /** returns true for an allow list, false for a deny list. */
+  isAllowList(): boolean;
+  /** frees the filter. */
+  delete(): void;
+}
+
+/**
+ * Bitset over labels, one bit per label up to the largest label. Best for dense labels as generated by `addItems`.
+ * @param {number[]} labels The labels of the set.
+ * @param {boolean} allowList true for an allow list, false for a deny list.
+ */
+export class LabelBitsetFilter extends LabelFilter {
+  constructor(labels: number[], allowList: boolean);
+  add(label: number): void;
+  addLabels(labels: number[]): void;
+  remove(label: number): void;
+  clear(): void;
+}
+
+/**
+ * Sorted label ranges, checked with a binary search. Best for labels allocated in blocks, e.g. one block per tenant.
+ * @param {boolean} allowList true for an allow list, false for a deny list.
+ */
+export class LabelRangeFilter extends LabelFilter {
+  constructor(allowList: boolean);
+  /**
+   * adds the labels `start` (inclusive) to `end` (exclusive), overlapping ranges are merged.
+   * @param {number} start The first label of the range.
+   * @param {number} end The label after the last label of the range.
+   */
+  addRange(start: number, end: number): void;
+  clear(): void;
+  /** returns the number of ranges after merging. */
+  getNumRanges(): number;
+}
+
+/**
+ * Hashed label set. Best for a small number of sparse labels.
+ * @param {number[]} labels The labels of the set.
+ * @param {boolean} allowList true for an allow list, false for a deny list.
+ */
+export class LabelSetFilter extends LabelFilter {
+  constructor(labels: number[], allowList: boolean);
+  add(label: number): void;
+  addLabels(labels: number[]): void;
+  remove(label: number): void;
+  clear(): void;
+}
+
 /**
  * L2 space object.
  * @param {number} numDimensions The dimensionality of space.
@@ -111,10 +194,10 @@ export class InnerProductSpace {
  */
 export class BruteforceSearch {
   /**
-   * @param {SpaceName} spaceName The metric space to create for the index ('l2', 'ip', or 'cosine').
+   * @param {BruteforceSearchSpaceName} spaceName The metric space to create for the index ('l2', 'ip', 'cosine' or their '-pq' variants).
    * @param {number} numDimensions The dimensionality of data points.
    */
-  constructor(spaceName: SpaceName, numDimensions: number);
+  constructor(spaceName: BruteforceSearchSpaceName, numDimensions: number);
 
   /** is index initialized */
   isIndexInitialized(): boolean;
@@ -146,16 +229,17 @@ export class BruteforceSearch {
    */
   removePoint(label: number): void;
   /**
-   * returns `numNeighbors` closest items for a given query point.
+   * returns `numNeighbors` closest items for a given query point, or all of them if the index holds fewer.
+   * With the pthread build and no JS filter function the scan is split across the worker threads.
    * @param {Float32Array | number[]} queryPoint The query point vector.
    * @param {number} numNeighbors The number of nearest neighbors to search for.
-   * @param {FilterFunction} filter The function filters elements by its labels.
+   * @param {FilterFunction | LabelFilter} filter The function or native label filter that filters elements by its labels.
    * @return {SearchResult} The search result object consists of distances and indices of the nearest neighbors found.
    */
   searchKnn(
     queryPoint: Float32Array | number[],
     numNeighbors: number,
-    filter: FilterFunction | undefined
+    filter: FilterFunction | LabelFilter | undefined
   ): SearchResult;
   /**
    * returns the maximum number of data points that can be indexed.
@@ -172,6 +256,16 @@ export class BruteforceSearch {
    * @return {number} The dimensionality of data points.
    */
   getNumDimensions(): number;
+  /**
+   * trains the product quantizer of the `-pq` spaces with k-means, it must be called before `initIndex`.
+   * The codebooks are saved next to the index in `<filename>.pq`.
+   * @param {Float32Array[] | number[][]} samples Vectors representative of the data, 256 or more for a full codebook.
+   * @param {number} numSubvectors The number of bytes per vector, it must divide the dimensionality.
+   * @param {number} iterations The number of k-means iterations.
+   */
+  trainProductQuantizer(samples: Float32Array[] | number[][], numSubvectors: number, iterations: number): void;
+  /** returns true once the quantizer of a `-pq` space is trained. */
+  isQuantizerTrained(): boolean;
 }
 
 /**
@@ -196,10 +290,12 @@ export class BruteforceSearch {
  */
 export class HierarchicalNSW {
   /**
-   * @param {SpaceName} spaceName The metric space to create for the index ('l2', 'ip', or 'cosine').
+   * @param {HierarchicalNSWSpaceName} spaceName The metric space to create for the index ('l2', 'ip', 'cosine' or their '-sq8' and '-pq' variants).
    * @param {number} numDimensions The dimesionality of metric space.
+   * @param {string} autoSaveFilename The file the index is saved to after every change, '' disables the auto save.
+   * Small changes are written as deltas next to it (`<autoSaveFilename>.delta.<n>`) and compacted into the file from time to time.
    */
-  constructor(spaceName: SpaceName, numDimensions: number, autoSaveFilename: string);
+  constructor(spaceName: HierarchicalNSWSpaceName, numDimensions: number, autoSaveFilename: string);
   /**
    * Initialize index.
    * @param {number} maxElements The maximum number of elements.
@@ -251,6 +347,41 @@ export class HierarchicalNSW {
    */
   addItems(items: Float32Array[] | number[][], replaceDeleted: boolean): number[];
 
+  /**
+   * Same as `addItems`, but splits the insertion across threads. Only the `threads` build runs in parallel, the other builds insert serially.
+   * @param {Float32Array[] | number[][]} items The datum array to be added to the search index.
+   * @param {number} numThreads The number of threads to use, 0 uses one thread per core.
+   * @param {boolean} replaceDeleted The flag to replace a deleted element (default: false).
+   * @return {number[]} The labels of the added items, in the order of `items`.
+   */
+  addItemsParallel(items: Float32Array[] | number[][], numThreads: number, replaceDeleted: boolean): number[];
+
+  /**
+   * zero copy version of `addPoint`, reads the datum point straight from the wasm heap (see `allocateHeapFloat32Array`).
+   * @param {number} dataPtr The byte offset of the datum point in the wasm heap.
+   * @param {number} label The index of the datum point.
+   * @param {boolean} replaceDeleted The flag to replace a deleted element (default: false).
+   */
+  addPointFromHeap(dataPtr: number, label: number, replaceDeleted: boolean): void;
+
+  /**
+   * zero copy version of `addPoints`, reads `count` datum points and labels straight from the wasm heap.
+   * @param {number} dataPtr The byte offset of `count * numDimensions` floats in the wasm heap.
+   * @param {number} labelsPtr The byte offset of `count` uint32 labels in the wasm heap.
+   * @param {number} count The number of datum points.
+   * @param {boolean} replaceDeleted The flag to replace a deleted element (default: false).
+   */
+  addPointsFromHeap(dataPtr: number, labelsPtr: number, count: number, replaceDeleted: boolean): void;
+
+  /**
+   * zero copy version of `addItems`, reads `count` datum points straight from the wasm heap.
+   * @param {number} dataPtr The byte offset of `count * numDimensions` floats in the wasm heap.
+   * @param {number} count The number of datum points.
+   * @param {boolean} replaceDeleted The flag to replace a deleted element (default: false).
+   * @return {number[]} The labels of the added datum points.
+   */
+  addItemsFromHeap(dataPtr: number, count: number, replaceDeleted: boolean): number[];
+
   // /**
   //  * adds a datum point to the search index.
   //  * @param {Float32Array[] | number[][]} items The datum array to be added to the search index.
@@ -279,18 +410,88 @@ export class HierarchicalNSW {
    * @param {number} label The index of the datum point to be unmarked.
    */
   unmarkDelete(label: number): void;
+  /**
+   * renumbers the data points so that graph neighbors are stored next to each other, which makes searches
+   * on large indexes more cache friendly. Labels and search results do not change. Call it once after a
+   * bulk build, not concurrently with insertions or searches.
+   * @param {'bfs' | 'rcm'} method Breadth first from the entry point or reverse Cuthill-McKee.
+   */
+  reorderIndex(method: 'bfs' | 'rcm'): void;
   /**
    * returns `numNeighbors` closest items for a given query point.
    * @param {Float32Array | number[]} queryPoint The query point vector.
    * @param {number} numNeighbors The number of nearest neighbors to search for.
-   * @param {FilterFunction} filter The function filters elements by its labels.
+   * @param {FilterFunction | LabelFilter} filter The function or native label filter that filters elements by its labels.
    * @return {SearchResult} The search result object consists of distances and indices of the nearest neighbors found.
    */
   searchKnn(
     queryPoint: Float32Array | number[],
     numNeighbors: number,
-    filter: FilterFunction | undefined
+    filter: FilterFunction | LabelFilter | undefined
   ): SearchResult;
+  /**
+   * returns `numNeighbors` closest items for each of `numQueries` query points in a single call.
+   * Rows with fewer than `numNeighbors` results are padded with an `Infinity` distance and the index `0xFFFFFFFF`.
+   * @param {Float32Array | number[]} queryPoints The query point vectors, concatenated (`numQueries * numDimensions` values).
+   * @param {number} numQueries The number of query points.
+   * @param {number} numNeighbors The number of nearest neighbors to search for.
+   * @param {FilterFunction | LabelFilter} filter Applied to every query. A function forces the queries to run serially on the calling thread, use a {@link LabelFilter} with the threads build.
+   * @return {BatchSearchResult} The flat distances and indices of the nearest neighbors found.
+   */
+  searchKnnBatch(
+    queryPoints: Float32Array | number[],
+    numQueries: number,
+    numNeighbors: number,
+    filter: FilterFunction | LabelFilter | undefined
+  ): BatchSearchResult;
+  /**
+   * zero copy version of `searchKnn`, reads the query point straight from the wasm heap.
+   * @param {number} queryPtr The byte offset of the query point in the wasm heap.
+   * @param {number} numNeighbors The number of nearest neighbors to search for.
+   * @param {FilterFunction | LabelFilter} filter The function or native label filter that filters elements by its labels.
+   * @return {SearchResult} The search result object consists of distances and indices of the nearest neighbors found.
+   */
+  searchKnnFromHeap(queryPtr: number, numNeighbors: number, filter: FilterFunction | LabelFilter | undefined): SearchResult;
+  /**
+   * trains the 8 bit quantizer of the `-sq8` spaces, it must be called before points are added.
+   * The quantization range is the min/max of the samples, the parameters are saved next to the index in `<filename>.sq8`.
+   * @param {Float32Array[] | number[][]} samples Vectors representative of the data.
+   * @param {boolean} perDimension One range per dimension instead of one range for all dimensions.
+   */
+  trainQuantizer(samples: Float32Array[] | number[][], perDimension: boolean): void;
+  /**
+   * trains the product quantizer of the `-pq` spaces with k-means, it must be called before `initIndex`.
+   * The codebooks are saved next to the index in `<filename>.pq`.
+   * @param {Float32Array[] | number[][]} samples Vectors representative of the data, 256 or more for a full codebook.
+   * @param {number} numSubvectors The number of bytes per vector, it must divide the dimensionality.
+   * @param {number} iterations The number of k-means iterations.
+   */
+  trainProductQuantizer(samples: Float32Array[] | number[][], numSubvectors: number, iterations: number): void;
+  /** returns true once the quantizer of a `-sq8` or `-pq` space is trained. */
+  isQuantizerTrained(): boolean;
+  /**
+   * `-sq8` spaces only, with a factor above 1 searches fetch `factor * numNeighbors` candidates and rerank them with the float query (default: 1).
+   * @param {number} factor The rerank factor.
+   */
+  setRerankFactor(factor: number): void;
+  /** returns the rerank factor. */
+  getRerankFactor(): number;
+  /**
+   * configures the auto save. Changes are coalesced and saved once no change happened for `debounceMs`,
+   * `maxPendingChanges` changes are pending or the first pending change is `maxLatencyMs` old. The save runs on the event loop.
+   * 0 disables the respective limit, the default debounce of 0 saves synchronously after every change.
+   * @param {number} debounceMs The quiet time before a save.
+   * @param {number} maxPendingChanges The number of changes that triggers a save right away.
+   * @param {number} maxLatencyMs The maximum time a change waits to be saved.
+   */
+  setAutoSaveOptions(debounceMs: number, maxPendingChanges: number, maxLatencyMs: number): void;
+  /** returns the number of changes waiting for the next auto save. */
+  getPendingAutoSaveChanges(): number;
+  /**
+   * saves the pending auto save changes now, see {@link flushAutoSave} for a promise.
+   * @param {() => void} callback Called once the files are synced to IDBFS.
+   */
+  flushAutoSave(callback: (() => void) | undefined): void;
   /**
    * returns a list of all used labels
    * @return {number[]} The list of indices.
@@ -332,6 +533,13 @@ export class HierarchicalNSW {
    * @param {number} ef The size of the dynamic list for the nearest neighbors.
    */
   setEfSearch(ef: number): void;
+  /**
+   * enables (the default) or disables the fallback of filtered searches. With a filter `searchKnn` estimates the share of
+   * labels it allows: selective filters are answered by an exact scan of the allowed points, others search the graph
+   * with an `ef` widened for the points the filter rejects.
+   * @param {boolean} enabled false to always search the graph with `ef`.
+   */
+  setFilterFallback(enabled: boolean): void;
 }
 
 export class EmscriptenFileSystemManager {
@@ -4,6 +4,9 @@
 #include <mutex>
 #include <algorithm>
 #include <assert.h>
+#include <exception>
+#include <thread>
+#include "search_heap.h"
 
 namespace hnswlib {
 template<typename dist_t>
@@ -16,6 +19,8 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
     size_t data_size_;
     DISTFUNC <dist_t> fstdistfunc_;
+    DISTFUNC <dist_t> fstquerydistfunc_;
+    BATCHDISTFUNC <dist_t> batchquerydistfunc_{nullptr};
     void *dist_func_param_;
     std::mutex index_lock;
 
@@ -47,6 +52,8 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
         maxelements_ = maxElements;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstquerydistfunc_ = s->get_query_dist_func();
+        batchquerydistfunc_ = s->get_batch_query_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         size_per_element_ = data_size_ + sizeof(labeltype);
         data_ = (char *) malloc(maxElements * size_per_element_);
@@ -97,35 +104,44 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
     }
 
 
+    typedef std::pair<dist_t, labeltype> Result;
+
+    // an element tile of about TILE_BYTES stays in L2 while the queries of a query tile are scanned against it,
+    // the blocking of a small matrix product of queries by elements
+    static constexpr size_t TILE_BYTES = 64 * 1024;
+    static constexpr size_t MIN_TILE = 16;
+    static constexpr size_t MAX_TILE = 1024;
+    static constexpr size_t QUERY_TILE = 16;
+    // smaller slices are not worth starting a thread for
+    static constexpr size_t MIN_ELEMENTS_PER_THREAD = 16384;
+
+
     std::priority_queue<std::pair<dist_t, labeltype >>
     searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        assert(k <= cur_element_count);
-        std::priority_queue<std::pair<dist_t, labeltype >> topResults;
-        if (cur_element_count == 0) return topResults;
-        for (int i = 0; i < k; i++) {
-            dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
-            labeltype label = *((labeltype*) (data_ + size_per_element_ * i + data_size_));
-            if ((!isIdAllowed) || (*isIdAllowed)(label)) {
-                topResults.push(std::pair<dist_t, labeltype>(dist, label));
-            }
-        }
-        dist_t lastdist = topResults.empty() ? std::numeric_limits<dist_t>::max() : topResults.top().first;
-        for (int i = k; i < cur_element_count; i++) {
-            dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
-            if (dist <= lastdist) {
-                labeltype label = *((labeltype *) (data_ + size_per_element_ * i + data_size_));
-                if ((!isIdAllowed) || (*isIdAllowed)(label)) {
-                    topResults.push(std::pair<dist_t, labeltype>(dist, label));
-                }
-                if (topResults.size() > k)
-                    topResults.pop();
+        return searchKnn(query_data, k, isIdAllowed, 1);
+    }
 
-                if (!topResults.empty()) {
-                    lastdist = topResults.top().first;
-                }
-            }
+
+    /// The scan split across up to num_threads threads, isIdAllowed must then be thread safe.
+    /// k larger than the number of elements returns all of them
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed, size_t num_threads) const {
+        std::vector<std::vector<Result>> results = search(&query_data, 1, k, isIdAllowed, num_threads);
+        return std::priority_queue<Result>(std::less<Result>(), std::move(results[0]));
+    }
+
+
+    /// searchKnn of every query, each element tile is loaded once for QUERY_TILE queries
+    std::vector<std::priority_queue<std::pair<dist_t, labeltype >>>
+    searchKnnBatch(const std::vector<const void *> &queries, size_t k, BaseFilterFunctor* isIdAllowed = nullptr,
+                   size_t num_threads = 1) const {
+        std::vector<std::vector<Result>> results = search(queries.data(), queries.size(), k, isIdAllowed, num_threads);
+        std::vector<std::priority_queue<Result>> queues;
+        queues.reserve(results.size());
+        for (std::vector<Result> &result : results) {
+            queues.emplace_back(std::less<Result>(), std::move(result));
         }
-        return topResults;
+        return queues;
     }
 
 
@@ -153,6 +169,8 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstquerydistfunc_ = s->get_query_dist_func();
+        batchquerydistfunc_ = s->get_batch_query_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         size_per_element_ = data_size_ + sizeof(labeltype);
         data_ = (char *) malloc(maxelements_ * size_per_element_);
@@ -163,5 +181,106 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
         input.close();
     }
+
+ private:
+    size_t tileSize() const {
+        return std::max(MIN_TILE, std::min(MAX_TILE, TILE_BYTES / std::max<size_t>(size_per_element_, 1)));
+    }
+
+    size_t scanThreads(size_t num_threads) const {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+        return 1;
+#else
+        return std::max<size_t>(1, std::min(num_threads, cur_element_count / MIN_ELEMENTS_PER_THREAD));
+#endif
+    }
+
+    /// Keeps the k nearest in the max-heap results, the filter is only asked about elements that would enter it
+    void addResult(std::vector<Result> &results, size_t k, dist_t dist, labeltype label, BaseFilterFunctor* isIdAllowed) const {
+        if (results.size() == k) {
+            if (!(dist < results.front().first)) return;
+            if (isIdAllowed && !(*isIdAllowed)(label)) return;
+            std::pop_heap(results.begin(), results.end());
+            results.back() = Result(dist, label);
+        } else {
+            if (isIdAllowed && !(*isIdAllowed)(label)) return;
+            results.emplace_back(dist, label);
+        }
+        std::push_heap(results.begin(), results.end());
+    }
+
+    /// Scans the elements [begin, end) for nq queries, results[q] is the max-heap of query q
+    void scanRange(const void *const *queries, size_t nq, size_t begin, size_t end, size_t k,
+                   BaseFilterFunctor* isIdAllowed, std::vector<Result> *results) const {
+        const size_t tile = tileSize();
+        SearchBuffer<const void *> elements(tile);
+        SearchBuffer<dist_t> dists(tile);
+        for (size_t query_start = 0; query_start < nq; query_start += QUERY_TILE) {
+            size_t query_end = std::min(nq, query_start + QUERY_TILE);
+            for (size_t start = begin; start < end; start += tile) {
+                size_t block = std::min(tile, end - start);
+                for (size_t j = 0; j < block; j++) elements.data[j] = data_ + size_per_element_ * (start + j);
+                for (size_t q = query_start; q < query_end; q++) {
+                    if (batchquerydistfunc_ != nullptr) {
+                        batchquerydistfunc_(queries[q], elements.data.data(), block, dist_func_param_, dists.data.data());
+                    } else {
+                        for (size_t j = 0; j < block; j++)
+                            dists.data[j] = fstquerydistfunc_(queries[q], elements.data[j], dist_func_param_);
+                    }
+                    for (size_t j = 0; j < block; j++) {
+                        labeltype label = *((labeltype *) ((const char *) elements.data[j] + data_size_));
+                        addResult(results[q], k, dists.data[j], label, isIdAllowed);
+                    }
+                }
+            }
+        }
+    }
+
+    /// The k nearest of every query as max-heaps, the elements are split in contiguous slices, one per thread,
+    /// and the heaps of the slices merged
+    std::vector<std::vector<Result>> search(const void *const *queries, size_t nq, size_t k,
+                                            BaseFilterFunctor* isIdAllowed, size_t num_threads) const {
+        k = std::min(k, cur_element_count);
+        std::vector<std::vector<Result>> results(nq);
+        if (k == 0) return results;
+        for (std::vector<Result> &result : results) result.reserve(k);
+
+        size_t threads = scanThreads(num_threads);
+        if (threads == 1) {
+            scanRange(queries, nq, 0, cur_element_count, k, isIdAllowed, results.data());
+            return results;
+        }
+
+        size_t slice = (cur_element_count + threads - 1) / threads;
+        std::vector<std::vector<std::vector<Result>>> partial(threads - 1, std::vector<std::vector<Result>>(nq));
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                try {
+                    scanRange(queries, nq, t * slice, std::min(cur_element_count, (t + 1) * slice), k,
+                              isIdAllowed, partial[t - 1].data());
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        try {
+            scanRange(queries, nq, 0, slice, k, isIdAllowed, results.data());
+        } catch (...) {
+            errors[0] = std::current_exception();
+        }
+        for (std::thread &worker : workers) worker.join();
+        for (std::exception_ptr &error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+
+        for (std::vector<std::vector<Result>> &slice_results : partial) {
+            for (size_t q = 0; q < nq; q++) {
+                for (const Result &result : slice_results[q]) addResult(results[q], k, result.first, result.second, nullptr);
+            }
+        }
+        return results;
+    }
 };
 }  // namespace hnswlib
@@ -1,13 +1,20 @@
 #pragma once
 
 #include "visited_list_pool.h"
+#include "label_map.h"
+#include "link_list_arena.h"
+#include "search_heap.h"
 #include "hnswlib.h"
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <random>
+#include <sstream>
 #include <stdlib.h>
 #include <assert.h>
 #include <unordered_set>
 #include <list>
+#include <numeric>
 
 namespace hnswlib {
 typedef unsigned int tableint;
@@ -34,6 +41,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     int maxlevel_{0};
 
     VisitedListPool *visited_list_pool_{nullptr};
+    VisitedSetKind visited_set_kind_{VISITED_AUTO};  // of searchKnn, construction always uses VisitedList
+    bool filter_fallback_{true};  // searchKnn scans the allowed elements or widens ef for selective filters
 
     // Locks operations with element by label value
     mutable std::vector<std::mutex> label_op_locks_;
@@ -47,16 +56,20 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     size_t offsetData_{0}, offsetLevel0_{0}, label_offset_{ 0 };
 
     char *data_level0_memory_{nullptr};
-    char **linkLists_{nullptr};
+    char **linkLists_{nullptr};  // upper layer link lists, allocated from link_list_arena_
+    LinkListArena link_list_arena_;
     std::vector<int> element_levels_;  // keeps level of each element
 
     size_t data_size_{0};
 
     DISTFUNC<dist_t> fstdistfunc_;
+    DISTFUNC<dist_t> fstquerydistfunc_;  // query to element distance, used by searchKnn
+    BATCHDISTFUNC<dist_t> batchdistfunc_{nullptr};  // batch versions, nullptr when the space has none
+    BATCHDISTFUNC<dist_t> batchquerydistfunc_{nullptr};
     void *dist_func_param_{nullptr};
 
     mutable std::mutex label_lookup_lock;  // lock for label_lookup_
-    std::unordered_map<labeltype, tableint> label_lookup_;
+    LabelMap label_lookup_;
 
     std::default_random_engine level_generator_;
     std::default_random_engine update_probability_generator_;
@@ -67,7 +80,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     bool allow_replace_deleted_ = false;  // flag to replace deleted elements (marked as deleted) during insertions
 
     std::mutex deleted_elements_lock;  // lock for deleted_elements
-    std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
+    ElementBitset deleted_elements;  // contains internal ids of deleted elements
+
+    bool track_dirty_elements_ = false;  // records the elements changed since the last saveDelta
+    std::mutex dirty_elements_lock_;  // lock for dirty_elements_
+    std::unordered_set<tableint> dirty_elements_;  // internal ids whose level0 block or link lists changed
 
 
     HierarchicalNSW(SpaceInterface<dist_t> *s) {
@@ -100,6 +117,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         num_deleted_ = 0;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstquerydistfunc_ = s->get_query_dist_func();
+        batchdistfunc_ = s->get_batch_dist_func();
+        batchquerydistfunc_ = s->get_batch_query_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         M_ = M;
         maxM_ = M_;
@@ -139,10 +159,6 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     ~HierarchicalNSW() {
         free(data_level0_memory_);
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
-        }
         free(linkLists_);
         delete visited_list_pool_;
     }
@@ -208,14 +224,15 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         return num_deleted_;
     }
 
-    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+    SearchHeap<std::pair<dist_t, tableint>, CompareByFirst>
     searchBaseLayer(tableint ep_id, const void *data_point, int layer) {
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
         vl_type *visited_array = vl->mass;
         vl_type visited_array_tag = vl->curV;
 
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidateSet;
+        SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> top_candidates;
+        SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> candidateSet;
+        top_candidates.reserve(ef_construction_ + 1);
 
         dist_t lowerBound;
         if (!isMarkedDeleted(ep_id)) {
@@ -291,19 +308,117 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /// The visited set searchBaseLayerST uses for ef: setVisitedSetKind, or the pool's choice for VISITED_AUTO
+    VisitedSetKind visitedSetKind(size_t ef) const {
+        if (visited_set_kind_ != VISITED_AUTO) return visited_set_kind_;
+        return visited_list_pool_->chooseVisitedSet(ef * maxM0_);
+    }
+
+
+    void setVisitedSetKind(VisitedSetKind kind) {
+        visited_set_kind_ = kind;
+    }
+
+
+    // the share of elements a filter allows is estimated on random elements, until this many are allowed ...
+    static constexpr size_t FILTER_SAMPLE_HITS = 32;
+    // ... or the filter calls cost this many distance computations (1024 calls of a native filter)
+    static constexpr size_t FILTER_SAMPLE_COST = 128;
+    static constexpr size_t MIN_FILTER_SAMPLES = 16;
+    // every estimate draws the same sample, identical searches take the same path
+    static constexpr uint32_t FILTER_SAMPLE_SEED = 1;
+    // a filtered graph search uses at most this many times ef
+    static constexpr size_t MAX_FILTER_EF_FACTOR = 4;
+
+    /// false: searchKnn always searches the graph with ef, whatever the filter
+    void setFilterFallback(bool enabled) {
+        filter_fallback_ = enabled;
+    }
+
+
+    /// Number of elements isIdAllowed accepts (deleted ones are not counted), estimated on elements drawn at random
+    /// from seed, so that labels allocated in blocks do not line up with the sample
+    size_t estimateAllowedCount(BaseFilterFunctor* isIdAllowed, uint32_t seed = FILTER_SAMPLE_SEED) const {
+        std::minstd_rand sample_generator(seed);
+        size_t count = cur_element_count;
+        size_t max_samples = std::min(count, std::max(MIN_FILTER_SAMPLES,
+                                                      static_cast<size_t>(FILTER_SAMPLE_COST / isIdAllowed->callCost())));
+        std::uniform_int_distribution<size_t> distribution(0, count - 1);
+        size_t samples = 0;
+        size_t allowed = 0;
+        while (samples < max_samples && allowed < FILTER_SAMPLE_HITS) {
+            tableint id = static_cast<tableint>(distribution(sample_generator));
+            samples++;
+            if (!isMarkedDeleted(id) && (*isIdAllowed)(getExternalLabel(id))) allowed++;
+        }
+        return (allowed * count + samples - 1) / samples;
+    }
+
+
+    /// The exact k nearest of the elements isIdAllowed accepts, searchKnn uses it when the filter is selective
+    SearchHeap<std::pair<dist_t, tableint>, CompareByFirst>
+    searchAllowedElements(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed) const {
+        SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> top_candidates;
+        top_candidates.reserve(k + 1);
+
+        const size_t block_size = 64;
+        tableint ids[block_size];
+        const void *elements[block_size];
+        dist_t dists[block_size];
+        size_t block = 0;
+        auto addBlock = [&]() {
+            queryDistances(query_data, elements, block, dists);
+            for (size_t j = 0; j < block; j++) {
+                if (top_candidates.size() < k || dists[j] < top_candidates.top().first) {
+                    top_candidates.emplace(dists[j], ids[j]);
+                    if (top_candidates.size() > k)
+                        top_candidates.pop();
+                }
+            }
+            metric_distance_computations += block;
+            block = 0;
+        };
+
+        size_t count = cur_element_count;
+        bool has_deletions = num_deleted_ != 0;
+        for (size_t i = 0; i < count; i++) {
+            tableint id = static_cast<tableint>(i);
+            if ((has_deletions && isMarkedDeleted(id)) || !(*isIdAllowed)(getExternalLabel(id))) continue;
+            ids[block] = id;
+            elements[block] = getDataByInternalId(id);
+            if (++block == block_size) addBlock();
+        }
+        if (block > 0) addBlock();
+        return top_candidates;
+    }
+
+
     template <bool has_deletions, bool collect_metrics = false>
-    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+    SearchHeap<std::pair<dist_t, tableint>, CompareByFirst>
     searchBaseLayerST(tableint ep_id, const void *data_point, size_t ef, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
+        switch (visitedSetKind(ef)) {
+            case VISITED_BITSET:
+                return searchBaseLayerST<has_deletions, collect_metrics, VisitedBitset>(ep_id, data_point, ef, isIdAllowed);
+            case VISITED_HASH:
+                return searchBaseLayerST<has_deletions, collect_metrics, VisitedHashSet>(ep_id, data_point, ef, isIdAllowed);
+            default:
+                return searchBaseLayerST<has_deletions, collect_metrics, VisitedList>(ep_id, data_point, ef, isIdAllowed);
+        }
+    }
 
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
+
+    template <bool has_deletions, bool collect_metrics, typename VisitedSet>
+    SearchHeap<std::pair<dist_t, tableint>, CompareByFirst>
+    searchBaseLayerST(tableint ep_id, const void *data_point, size_t ef, BaseFilterFunctor* isIdAllowed) const {
+        VisitedSet *visited = visited_list_pool_->getFreeVisitedSet<VisitedSet>(ef * maxM0_);
+
+        SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> top_candidates;
+        SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> candidate_set;
+        top_candidates.reserve(ef + 1);
 
         dist_t lowerBound;
         if ((!has_deletions || !isMarkedDeleted(ep_id)) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id)))) {
-            dist_t dist = fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
+            dist_t dist = fstquerydistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
             lowerBound = dist;
             top_candidates.emplace(dist, ep_id);
             candidate_set.emplace(-dist, ep_id);
@@ -312,7 +427,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             candidate_set.emplace(-lowerBound, ep_id);
         }
 
-        visited_array[ep_id] = visited_array_tag;
+        visited->visit(ep_id);
+
+#ifdef HNSW_GATHER_SEARCH
+        SearchBuffer<tableint> gathered(maxM0_);
+        SearchBuffer<const void *> gathered_data(maxM0_);
+        SearchBuffer<dist_t> gathered_dists(maxM0_);
+#endif
 
         while (!candidate_set.empty()) {
             std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
@@ -332,9 +453,41 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 metric_distance_computations+=size;
             }
 
+#ifdef HNSW_GATHER_SEARCH
+            // the distances do not depend on lowerBound, so computing them before the heap updates
+            // gives the same result as the interleaved loop below
+            size_t gathered_count = 0;
+            for (size_t j = 1; j <= size; j++) {
+                tableint candidate_id = *(data + j);
+                if (visited->visit(candidate_id)) {
+                    gathered_data.data[gathered_count] = getDataByInternalId(candidate_id);
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
+                    _mm_prefetch((const char *) gathered_data.data[gathered_count], _MM_HINT_T0);
+#endif
+                    gathered.data[gathered_count++] = candidate_id;
+                }
+            }
+            queryDistances(data_point, gathered_data.data.data(), gathered_count, gathered_dists.data.data());
+            for (size_t j = 0; j < gathered_count; j++) {
+                tableint candidate_id = gathered.data[j];
+                dist_t dist = gathered_dists.data[j];
+                if (top_candidates.size() < ef || lowerBound > dist) {
+                    candidate_set.emplace(-dist, candidate_id);
+
+                    if ((!has_deletions || !isMarkedDeleted(candidate_id)) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))
+                        top_candidates.emplace(dist, candidate_id);
+
+                    if (top_candidates.size() > ef)
+                        top_candidates.pop();
+
+                    if (!top_candidates.empty())
+                        lowerBound = top_candidates.top().first;
+                }
+            }
+#else
+#ifdef USE_SSE
+            visited->prefetch(*(data + 1));
+            visited->prefetch(*(data + 1) + 64);
             _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
             _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
 #endif
@@ -343,15 +496,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 int candidate_id = *(data + j);
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
+                visited->prefetch(*(data + j + 1));
                 _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
                                 _MM_HINT_T0);  ////////////
 #endif
-                if (!(visited_array[candidate_id] == visited_array_tag)) {
-                    visited_array[candidate_id] = visited_array_tag;
-
+                if (visited->visit(candidate_id)) {
                     char *currObj1 = (getDataByInternalId(candidate_id));
-                    dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+                    dist_t dist = fstquerydistfunc_(data_point, currObj1, dist_func_param_);
 
                     if (top_candidates.size() < ef || lowerBound > dist) {
                         candidate_set.emplace(-dist, candidate_id);
@@ -372,15 +523,36 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     }
                 }
             }
+#endif
         }
 
-        visited_list_pool_->releaseVisitedList(vl);
+        visited_list_pool_->releaseVisitedSet(visited);
         return top_candidates;
     }
 
 
+    // dists[i] = distance of the query to elements[i], through the batch function of the space when it has one
+    void queryDistances(const void *query, const void *const *elements, size_t count, dist_t *dists) const {
+        if (batchquerydistfunc_ != nullptr) {
+            batchquerydistfunc_(query, elements, count, dist_func_param_, dists);
+            return;
+        }
+        for (size_t i = 0; i < count; i++) dists[i] = fstquerydistfunc_(query, elements[i], dist_func_param_);
+    }
+
+
+    // same as queryDistances for a stored element, with the element to element distance
+    void elementDistances(const void *element, const void *const *elements, size_t count, dist_t *dists) const {
+        if (batchdistfunc_ != nullptr) {
+            batchdistfunc_(element, elements, count, dist_func_param_, dists);
+            return;
+        }
+        for (size_t i = 0; i < count; i++) dists[i] = fstdistfunc_(element, elements[i], dist_func_param_);
+    }
+
+
     void getNeighborsByHeuristic2(
-            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> &top_candidates,
+            SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> &top_candidates,
     const size_t M) {
         if (top_candidates.size() < M) {
             return;
@@ -401,14 +573,18 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             queue_closest.pop();
             bool good = true;
 
-            for (std::pair<dist_t, tableint> second_pair : return_list) {
-                dist_t curdist =
-                        fstdistfunc_(getDataByInternalId(second_pair.second),
-                                        getDataByInternalId(curent_pair.second),
-                                        dist_func_param_);
-                if (curdist < dist_to_query) {
-                    good = false;
-                    break;
+            // blocks of four keep most of the early exit while the batch kernel reuses the loaded candidate
+            for (size_t j = 0; good && j < return_list.size(); j += 4) {
+                const void *selected[4];
+                dist_t curdists[4];
+                size_t block = std::min<size_t>(4, return_list.size() - j);
+                for (size_t t = 0; t < block; t++) selected[t] = getDataByInternalId(return_list[j + t].second);
+                elementDistances(getDataByInternalId(curent_pair.second), selected, block, curdists);
+                for (size_t t = 0; t < block; t++) {
+                    if (curdists[t] < dist_to_query) {
+                        good = false;
+                        break;
+                    }
                 }
             }
             if (good) {
@@ -445,7 +621,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     tableint mutuallyConnectNewElement(
         const void *data_point,
         tableint cur_c,
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> &top_candidates,
+        SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> &top_candidates,
         int level,
         bool isUpdate) {
         size_t Mcurmax = level ? maxM_ : maxM0_;
@@ -492,6 +668,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
             std::unique_lock <std::mutex> lock(link_list_locks_[selectedNeighbors[idx]]);
+            markDirty(selectedNeighbors[idx]);
 
             linklistsizeint *ll_other;
             if (level == 0)
@@ -530,7 +707,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     dist_t d_max = fstdistfunc_(getDataByInternalId(cur_c), getDataByInternalId(selectedNeighbors[idx]),
                                                 dist_func_param_);
                     // Heuristic:
-                    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+                    SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> candidates;
                     candidates.emplace(d_max, cur_c);
 
                     for (size_t j = 0; j < sz_link_list_other; j++) {
@@ -596,33 +773,229 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    void saveIndex(const std::string &location) {
-        std::ofstream output(location, std::ios::binary);
-        std::streampos position;
+    enum ReorderMethod {
+        REORDER_BFS,  // breadth first from the entry point over the level 0 graph
+        REORDER_RCM,  // reverse Cuthill-McKee: breadth first from low degree elements, neighbors by increasing degree, reversed
+    };
+
+
+    /*
+    * Renumbers the internal ids so that elements that are neighbors in the level 0 graph are close in
+    * data_level0_memory_, the vectors a search visits then share cache lines and pages.  Level 0 blocks,
+    * link lists, element levels, the label lookup and the deleted set are permuted, labels do not change.
+    * Elements the traversal does not reach seed further traversals (in id order for BFS).
+    * Offline operation: must not run concurrently with insertions or searches.
+    */
+    void reorderIndex(ReorderMethod method = REORDER_BFS) {
+        const size_t count = cur_element_count;
+        if (count == 0)
+            return;
+
+        std::vector<tableint> order = reorderPermutation(method);  // order[new id] = old id
+        std::vector<tableint> new_ids(count);
+        for (size_t i = 0; i < count; i++) new_ids[order[i]] = i;
+
+        auto remapList = [&](linklistsizeint *ll) {
+            tableint *neighbors = (tableint *) (ll + 1);
+            for (size_t j = 0, size = getListCount(ll); j < size; j++) neighbors[j] = new_ids[neighbors[j]];
+        };
+
+        char *level0 = (char *) malloc(max_elements_ * size_data_per_element_);
+        if (level0 == nullptr)
+            throw std::runtime_error("Not enough memory: reorderIndex failed to allocate level0");
+        std::vector<char *> link_lists(count);
+        std::vector<int> levels(count);
+        for (size_t i = 0; i < count; i++) {
+            memcpy(level0 + i * size_data_per_element_, data_level0_memory_ + order[i] * size_data_per_element_, size_data_per_element_);
+            remapList(get_linklist0(i, level0));
+            link_lists[i] = linkLists_[order[i]];
+            levels[i] = element_levels_[order[i]];
+        }
+        free(data_level0_memory_);
+        data_level0_memory_ = level0;
+        std::copy(link_lists.begin(), link_lists.end(), linkLists_);
+        std::copy(levels.begin(), levels.end(), element_levels_.begin());
+        for (size_t i = 0; i < count; i++) {
+            for (int level = 1; level <= element_levels_[i]; level++) remapList(get_linklist(i, level));
+        }
+        enterpoint_node_ = new_ids[enterpoint_node_];
 
-        writeBinaryPOD(output, offsetLevel0_);
-        writeBinaryPOD(output, max_elements_);
-        writeBinaryPOD(output, cur_element_count);
-        writeBinaryPOD(output, size_data_per_element_);
-        writeBinaryPOD(output, label_offset_);
-        writeBinaryPOD(output, offsetData_);
-        writeBinaryPOD(output, maxlevel_);
-        writeBinaryPOD(output, enterpoint_node_);
-        writeBinaryPOD(output, maxM_);
+        label_lookup_.clear();
+        deleted_elements.clear();
+        for (size_t i = 0; i < count; i++) {
+            label_lookup_.assign(getExternalLabel(i), i);
+            if (isMarkedDeleted(i)) deleted_elements.insert(i);
+        }
 
-        writeBinaryPOD(output, maxM0_);
-        writeBinaryPOD(output, M_);
-        writeBinaryPOD(output, mult_);
-        writeBinaryPOD(output, ef_construction_);
+        // every element moved, a delta against an earlier snapshot no longer applies
+        std::unique_lock <std::mutex> lock(dirty_elements_lock_);
+        if (track_dirty_elements_) {
+            for (size_t i = 0; i < count; i++) dirty_elements_.insert(i);
+        }
+    }
 
-        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
 
+    std::vector<tableint> reorderPermutation(ReorderMethod method) const {
+        const size_t count = cur_element_count;
+        std::vector<tableint> order;
+        order.reserve(count);
+        std::vector<bool> visited(count, false);
+        std::vector<tableint> neighbors;
+
+        // RCM seeds every component with its lowest degree element, BFS with the entry point first
+        std::vector<tableint> seeds(count);
+        std::iota(seeds.begin(), seeds.end(), 0);
+        if (method == REORDER_RCM) {
+            std::stable_sort(seeds.begin(), seeds.end(), [&](tableint a, tableint b) {
+                return getListCount(get_linklist0(a)) < getListCount(get_linklist0(b));
+            });
+        } else {
+            std::rotate(seeds.begin(), seeds.begin() + enterpoint_node_, seeds.begin() + enterpoint_node_ + 1);
+        }
+
+        for (tableint seed : seeds) {
+            if (visited[seed]) continue;
+            visited[seed] = true;
+            // order doubles as the queue, elements are appended when first seen
+            size_t head = order.size();
+            order.push_back(seed);
+            for (; head < order.size(); head++) {
+                linklistsizeint *ll = get_linklist0(order[head]);
+                tableint *data = (tableint *) (ll + 1);
+                neighbors.assign(data, data + getListCount(ll));
+                if (method == REORDER_RCM) {
+                    std::stable_sort(neighbors.begin(), neighbors.end(), [&](tableint a, tableint b) {
+                        return getListCount(get_linklist0(a)) < getListCount(get_linklist0(b));
+                    });
+                }
+                for (tableint neighbor : neighbors) {
+                    if (visited[neighbor]) continue;
+                    visited[neighbor] = true;
+                    order.push_back(neighbor);
+                }
+            }
+        }
+
+        if (method == REORDER_RCM)
+            std::reverse(order.begin(), order.end());
+        return order;
+    }
+
+
+    /*
+    * On-disk format (version 2), all integers in the byte order of the writer:
+    *
+    *   magic "HNSWIDX\0", uint32 version, uint32 byte order mark, uint32 section count, uint32 CRC-32 of the table
+    *   section table, {uint32 id, uint32 CRC-32, uint64 offset, uint64 size} per section
+    *   sections, each starting at a multiple of INDEX_SECTION_ALIGNMENT bytes
+    *
+    * PARAMS holds the header fields of the old format, LEVEL0 the level 0 blocks as in memory, LINK_LISTS
+    * the level of every element (int) followed by the upper layer link lists in element order, LABELS the label lookup table as in memory
+    * (uint64 capacity, capacity labels, capacity internal ids, see LabelMap), DELETED the words of the deleted
+    * set (bit i of word i / 64 for internal id i) and METADATA the element data size.  The label lookup and the
+    * deleted set are loaded as they are, without rehashing or a scan over the elements.  The checksums replace the
+    * structural validation pass of the old format, which is still read when the magic is missing.
+    * Unknown section ids are skipped so that sections can be added without a version bump.
+    */
+    static constexpr const char *INDEX_MAGIC = "HNSWIDX";
+    static constexpr uint32_t INDEX_FORMAT_VERSION = 2;
+    static constexpr uint32_t INDEX_BYTE_ORDER_MARK = 0x01020304;
+    static constexpr size_t INDEX_SECTION_ALIGNMENT = 64;
+    static constexpr uint32_t MAX_INDEX_SECTIONS = 64;
+
+    enum IndexSectionId : uint32_t {
+        SECTION_PARAMS = 1,
+        SECTION_LEVEL0 = 2,
+        SECTION_LINK_LISTS = 3,
+        SECTION_LABELS = 4,
+        SECTION_DELETED = 5,
+        SECTION_METADATA = 6,
+    };
+
+    struct IndexSectionEntry {
+        uint32_t id;
+        uint32_t crc;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+
+    void saveIndex(const std::string &location) {
+        std::ofstream output(location, std::ios::binary);
+        const uint32_t section_count = 6;
+
+        // the file header and the table are rewritten once the section offsets and checksums are known
+        const size_t table_end = sizeof(char[8]) + 4 * sizeof(uint32_t) + section_count * sizeof(IndexSectionEntry);
+        std::vector<char> zeros(std::max(table_end, INDEX_SECTION_ALIGNMENT), 0);
+        output.write(zeros.data(), table_end);
+
+        std::vector<IndexSectionEntry> sections;
+        uint64_t position = 0;
+        auto beginSection = [&](uint32_t id) {
+            position = static_cast<uint64_t>(output.tellp());
+            size_t padding = (INDEX_SECTION_ALIGNMENT - position % INDEX_SECTION_ALIGNMENT) % INDEX_SECTION_ALIGNMENT;
+            output.write(zeros.data(), padding);
+            position += padding;
+            sections.push_back({id, 0, position, 0});
+        };
+        auto writeSection = [&](const void *data, size_t size) {
+            output.write((const char *) data, size);
+            sections.back().crc = crc32Update(sections.back().crc, data, size);
+            sections.back().size += size;
+        };
+
+        std::ostringstream params;
+        writeBinaryPOD(params, offsetLevel0_);
+        writeBinaryPOD(params, max_elements_);
+        writeBinaryPOD(params, cur_element_count);
+        writeBinaryPOD(params, size_data_per_element_);
+        writeBinaryPOD(params, label_offset_);
+        writeBinaryPOD(params, offsetData_);
+        writeBinaryPOD(params, maxlevel_);
+        writeBinaryPOD(params, enterpoint_node_);
+        writeBinaryPOD(params, maxM_);
+        writeBinaryPOD(params, maxM0_);
+        writeBinaryPOD(params, M_);
+        writeBinaryPOD(params, mult_);
+        writeBinaryPOD(params, ef_construction_);
+        const std::string params_data = params.str();
+        beginSection(SECTION_PARAMS);
+        writeSection(params_data.data(), params_data.size());
+
+        beginSection(SECTION_LEVEL0);
+        writeSection(data_level0_memory_, cur_element_count * size_data_per_element_);
+
+        beginSection(SECTION_LINK_LISTS);
+        writeSection(element_levels_.data(), cur_element_count * sizeof(int));
         for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-            writeBinaryPOD(output, linkListSize);
-            if (linkListSize)
-                output.write(linkLists_[i], linkListSize);
+            if (element_levels_[i] > 0)
+                writeSection(linkLists_[i], size_links_per_element_ * element_levels_[i]);
         }
+
+        beginSection(SECTION_LABELS);
+        uint64_t label_capacity = label_lookup_.capacity();
+        writeSection(&label_capacity, sizeof(uint64_t));
+        writeSection(label_lookup_.keys().data(), label_lookup_.keys().size() * sizeof(labeltype));
+        writeSection(label_lookup_.values().data(), label_lookup_.values().size() * sizeof(tableint));
+
+        // the set only has words up to its largest id, the section always covers every element
+        std::vector<uint64_t> deleted((cur_element_count + 63) / 64, 0);
+        std::copy_n(deleted_elements.words().begin(), std::min(deleted.size(), deleted_elements.words().size()), deleted.begin());
+        beginSection(SECTION_DELETED);
+        writeSection(deleted.data(), deleted.size() * sizeof(uint64_t));
+
+        beginSection(SECTION_METADATA);
+        uint64_t data_size = data_size_;
+        writeSection(&data_size, sizeof(uint64_t));
+
+        const uint32_t table_crc = crc32Update(0, sections.data(), sections.size() * sizeof(IndexSectionEntry));
+        output.seekp(0);
+        output.write(INDEX_MAGIC, sizeof(char[8]));
+        writeBinaryPOD(output, INDEX_FORMAT_VERSION);
+        writeBinaryPOD(output, INDEX_BYTE_ORDER_MARK);
+        writeBinaryPOD(output, section_count);
+        writeBinaryPOD(output, table_crc);
+        output.write((const char *) sections.data(), sections.size() * sizeof(IndexSectionEntry));
         output.close();
     }
 
@@ -630,6 +1003,122 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
         std::ifstream input(location, std::ios::binary);
 
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        char magic[8] = {};
+        input.read(magic, sizeof(magic));
+        if (!input || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0) {
+            input.close();
+            loadLegacyIndex(location, s, max_elements_i);
+            return;
+        }
+
+        input.seekg(0, input.end);
+        const uint64_t total_filesize = static_cast<uint64_t>(input.tellg());
+        input.seekg(sizeof(magic), input.beg);
+
+        uint32_t version, byte_order, section_count, table_crc;
+        readBinaryPOD(input, version);
+        readBinaryPOD(input, byte_order);
+        readBinaryPOD(input, section_count);
+        readBinaryPOD(input, table_crc);
+        if (input && byte_order != INDEX_BYTE_ORDER_MARK)
+            throw std::runtime_error("Index was saved on a machine with a different byte order");
+        if (input && version != INDEX_FORMAT_VERSION)
+            throw std::runtime_error("Unsupported index format version " + std::to_string(version));
+        if (!input || section_count > MAX_INDEX_SECTIONS)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        std::vector<IndexSectionEntry> sections(section_count);
+        input.read((char *) sections.data(), section_count * sizeof(IndexSectionEntry));
+        if (!input || crc32Update(0, sections.data(), section_count * sizeof(IndexSectionEntry)) != table_crc)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        const IndexSectionEntry *found[SECTION_METADATA + 1] = {};
+        uint64_t sections_end = 0;
+        for (const IndexSectionEntry &section : sections) {
+            if (section.offset > total_filesize || section.size > total_filesize - section.offset)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            sections_end = std::max(sections_end, section.offset + section.size);
+            if (section.id >= SECTION_PARAMS && section.id <= SECTION_METADATA)
+                found[section.id] = &section;
+        }
+        if (sections_end != total_filesize)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        for (uint32_t id = SECTION_PARAMS; id <= SECTION_METADATA; id++) {
+            if (found[id] == nullptr)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+
+        // reads a whole section to dst and checks its checksum
+        auto readSection = [&](const IndexSectionEntry &section, char *dst) {
+            input.seekg(section.offset, input.beg);
+            input.read(dst, section.size);
+            return input && crc32Update(0, dst, section.size) == section.crc;
+        };
+        auto readSectionVector = [&](const IndexSectionEntry &section, std::vector<char> &dst) {
+            dst.resize(section.size);
+            return readSection(section, dst.data());
+        };
+
+        std::vector<char> params, metadata;
+        if (!readSectionVector(*found[SECTION_PARAMS], params) || !readSectionVector(*found[SECTION_METADATA], metadata) ||
+            metadata.size() != sizeof(uint64_t))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        std::istringstream params_input(std::string(params.data(), params.size()));
+        readIndexParams(params_input, s, max_elements_i);
+        uint64_t data_size;
+        memcpy(&data_size, metadata.data(), sizeof(uint64_t));
+        if (!params_input || params_input.peek() != EOF || data_size != data_size_ ||
+            found[SECTION_LEVEL0]->size != cur_element_count * size_data_per_element_ ||
+            found[SECTION_LINK_LISTS]->size < cur_element_count * sizeof(int) ||
+            found[SECTION_LABELS]->size < sizeof(uint64_t) ||
+            found[SECTION_DELETED]->size != (cur_element_count + 63) / 64 * sizeof(uint64_t))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        allocateLoadedIndex();
+        std::vector<char> labels, deleted;
+        if (!readSection(*found[SECTION_LEVEL0], data_level0_memory_) ||
+            !readLinkListsSection(input, *found[SECTION_LINK_LISTS]) ||
+            !readSectionVector(*found[SECTION_LABELS], labels) ||
+            !readSectionVector(*found[SECTION_DELETED], deleted)) {
+            releaseLoadedIndex();
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+        input.close();
+
+        uint64_t label_capacity;
+        memcpy(&label_capacity, labels.data(), sizeof(uint64_t));
+        std::vector<uint64_t> deleted_words(deleted.size() / sizeof(uint64_t));
+        memcpy(deleted_words.data(), deleted.data(), deleted.size());
+        const uint64_t tail_bits = cur_element_count % 64;
+        if (label_capacity > labels.size() || labels.size() - sizeof(uint64_t) != LabelMap::tableSize(label_capacity) ||
+            !label_lookup_.loadTable(labels.data() + sizeof(uint64_t), label_capacity, cur_element_count) ||
+            !labelLookupMatchesElements() ||
+            (tail_bits != 0 && (deleted_words.back() >> tail_bits) != 0)) {
+            releaseLoadedIndex();
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+        deleted_elements.assignWords(deleted_words.data(), deleted_words.size());
+        num_deleted_ = deleted_elements.size();
+    }
+
+
+    // every entry of the label lookup points at an element that has its label.  The lookup may hold fewer labels
+    // than there are elements, e.g. a deleted element whose label was given to another element
+    bool labelLookupMatchesElements() const {
+        for (const LabelMap::value_type &entry : label_lookup_) {
+            if (entry.second >= cur_element_count || getExternalLabel(entry.second) != entry.first) return false;
+        }
+        return true;
+    }
+
+
+    // the index format before the section table, the header is validated and the link lists are parsed in one pass
+    void loadLegacyIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i) {
+        std::ifstream input(location, std::ios::binary);
+
         if (!input.is_open())
             throw std::runtime_error("Cannot open file");
 
@@ -638,6 +1127,41 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         std::streampos total_filesize = input.tellg();
         input.seekg(0, input.beg);
 
+        readIndexParams(input, s, max_elements_i);
+
+        // header-only validation, the link list sizes are checked while they are parsed below
+        const std::streamoff level0_start = input.tellg();
+        const std::streamoff level0_size = cur_element_count * size_data_per_element_;
+        if (!input ||
+            total_filesize - level0_start < level0_size + static_cast<std::streamoff>(cur_element_count * sizeof(unsigned int))) {
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+
+        // the link lists of the upper layers are read with one read and parsed in memory, not with a read per element
+        allocateLoadedIndex();
+        input.read(data_level0_memory_, level0_size);
+        std::vector<char> link_lists(static_cast<size_t>(total_filesize - level0_start - level0_size));
+        input.read(link_lists.data(), link_lists.size());
+        if (!input) {
+            releaseLoadedIndex();
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+        input.close();
+
+        loadLinkLists(link_lists.data(), link_lists.size());
+
+        for (size_t i = 0; i < cur_element_count; i++) {
+            label_lookup_.assign(getExternalLabel(i), i);
+            if (isMarkedDeleted(i)) {
+                num_deleted_ += 1;
+                deleted_elements.insert(i);
+            }
+        }
+    }
+
+
+    // reads the header fields shared by both formats and validates them against the space
+    void readIndexParams(std::istream &input, SpaceInterface<dist_t> *s, size_t max_elements_i) {
         readBinaryPOD(input, offsetLevel0_);
         readBinaryPOD(input, max_elements_);
         readBinaryPOD(input, cur_element_count);
@@ -660,78 +1184,336 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstquerydistfunc_ = s->get_query_dist_func();
+        batchdistfunc_ = s->get_batch_dist_func();
+        batchquerydistfunc_ = s->get_batch_query_dist_func();
         dist_func_param_ = s->get_dist_func_param();
 
-        auto pos = input.tellg();
-
-        /// Optional - check if index is ok:
-        input.seekg(cur_element_count * size_data_per_element_, input.cur);
-        for (size_t i = 0; i < cur_element_count; i++) {
-            if (input.tellg() < 0 || input.tellg() >= total_filesize) {
-                throw std::runtime_error("Index seems to be corrupted or unsupported");
-            }
-
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize != 0) {
-                input.seekg(linkListSize, input.cur);
-            }
-        }
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
 
-        // throw exception if it either corrupted or old index
-        if (input.tellg() != total_filesize)
+        if (!input || maxM_ == 0 || size_data_per_element_ != size_links_level0_ + data_size_ + sizeof(labeltype) ||
+            offsetData_ != size_links_level0_ || label_offset_ != size_links_level0_ + data_size_ ||
+            cur_element_count > max_elements_) {
+            cur_element_count = 0;
             throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+    }
 
-        input.clear();
-        /// Optional check end
-
-        input.seekg(pos, input.beg);
 
-        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
+    void allocateLoadedIndex() {
+        data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);
         if (data_level0_memory_ == nullptr)
             throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
-        input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
-
-        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
 
-        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
+        std::vector<std::mutex>(max_elements_).swap(link_list_locks_);
         std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
 
-        visited_list_pool_ = new VisitedListPool(1, max_elements);
+        visited_list_pool_ = new VisitedListPool(1, max_elements_);
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
+        linkLists_ = (char **) malloc(sizeof(void *) * max_elements_);
         if (linkLists_ == nullptr)
             throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
-        element_levels_ = std::vector<int>(max_elements);
+        element_levels_ = std::vector<int>(max_elements_);
         revSize_ = 1.0 / mult_;
         ef_ = 10;
+        label_lookup_.reserve(cur_element_count);
+    }
+
+
+    // the constructor throws, so the destructor will not release what was read so far
+    void releaseLoadedIndex() {
+        link_list_arena_.clear();
+        free(linkLists_);
+        free(data_level0_memory_);
+        delete visited_list_pool_;
+        linkLists_ = nullptr;
+        data_level0_memory_ = nullptr;
+        visited_list_pool_ = nullptr;
+        cur_element_count = 0;
+    }
+
+
+    /*
+    * Reads the LINK_LISTS section: the element levels straight into element_levels_ and the lists,
+    * already in element order, with one read into one arena block.  Returns false on a checksum mismatch
+    * or levels that do not add up to the section size.
+    */
+    bool readLinkListsSection(std::ifstream &input, const IndexSectionEntry &section) {
+        const size_t levels_size = cur_element_count * sizeof(int);
+        const size_t lists_size = section.size - levels_size;
+        input.seekg(section.offset, input.beg);
+        input.read((char *) element_levels_.data(), levels_size);
+        char *lists = link_list_arena_.allocateBlock(lists_size);
+        input.read(lists, lists_size);
+        if (!input || crc32Update(crc32Update(0, element_levels_.data(), levels_size), lists, lists_size) != section.crc)
+            return false;
+
+        size_t pos = 0;
         for (size_t i = 0; i < cur_element_count; i++) {
-            label_lookup_[getExternalLabel(i)] = i;
+            const int level = element_levels_[i];
+            if (level < 0 || level > maxlevel_ || size_links_per_element_ * level > lists_size - pos)
+                return false;
+            linkLists_[i] = level > 0 ? lists + pos : nullptr;
+            pos += size_links_per_element_ * level;
+        }
+        return pos == lists_size;
+    }
+
+
+    // copies the upper layer link lists of all elements out of the serialized (byte size, list) records
+    // of the old format into one arena block
+    void loadLinkLists(const char *data, size_t size) {
+        char *lists = link_list_arena_.allocateBlock(size);
+        size_t lists_pos = 0;
+        size_t pos = 0;
+        size_t parsed = 0;
+        for (; parsed < cur_element_count; parsed++) {
             unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize == 0) {
-                element_levels_[i] = 0;
-                linkLists_[i] = nullptr;
-            } else {
-                element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char *) malloc(linkListSize);
-                if (linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                input.read(linkLists_[i], linkListSize);
+            if (size - pos < sizeof(unsigned int))
+                break;
+            memcpy(&linkListSize, data + pos, sizeof(unsigned int));
+            pos += sizeof(unsigned int);
+            if (linkListSize % size_links_per_element_ != 0 || linkListSize > size - pos)
+                break;
+
+            element_levels_[parsed] = linkListSize / size_links_per_element_;
+            linkLists_[parsed] = linkListSize == 0 ? nullptr : lists + lists_pos;
+            memcpy(lists + lists_pos, data + pos, linkListSize);
+            lists_pos += linkListSize;
+            pos += linkListSize;
+        }
+
+        // a bad link list size or trailing bytes, the file is either corrupted or an old index
+        if (parsed != cur_element_count || pos != size) {
+            releaseLoadedIndex();
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+    }
+
+
+    /*
+    * Dirty tracking records the internal ids changed by insertions, updates and delete marks,
+    * saveDelta then writes only those elements instead of the whole index.
+    */
+    void setDirtyTracking(bool enabled) {
+        std::unique_lock <std::mutex> lock(dirty_elements_lock_);
+        track_dirty_elements_ = enabled;
+        dirty_elements_.clear();
+    }
+
+
+    inline void markDirty(tableint internalId) {
+        if (!track_dirty_elements_)
+            return;
+        std::unique_lock <std::mutex> lock(dirty_elements_lock_);
+        dirty_elements_.insert(internalId);
+    }
+
+
+    size_t getDirtyCount() {
+        std::unique_lock <std::mutex> lock(dirty_elements_lock_);
+        return dirty_elements_.size();
+    }
+
+
+    void clearDirty() {
+        std::unique_lock <std::mutex> lock(dirty_elements_lock_);
+        dirty_elements_.clear();
+    }
+
+
+    /*
+    * Delta format (version 1), all integers in the byte order of the writer:
+    *
+    *   magic "HNSWDLT\0", uint32 version, uint32 byte order mark, uint32 CRC-32 of the body
+    *   body: size_t data size per element, size_t max elements, size_t element count, int maxlevel,
+    *   uint32 entry point, size_t record count, then per record uint32 internal id, the level0 block,
+    *   uint32 byte size of the upper link lists and the lists
+    */
+    static constexpr const char *DELTA_MAGIC = "HNSWDLT";
+    static constexpr uint32_t DELTA_FORMAT_VERSION = 1;
+
+
+    /*
+    * Writes the elements changed since the last saveIndex/saveDelta (level0 block and upper link lists)
+    * and the index header to location.  Must not run concurrently with insertions.  Deltas are applied
+    * in order on top of the snapshot they were taken from with loadDelta.
+    */
+    void saveDelta(const std::string &location) {
+        std::unique_lock <std::mutex> lock(dirty_elements_lock_);
+        std::vector<tableint> ids(dirty_elements_.begin(), dirty_elements_.end());
+        std::sort(ids.begin(), ids.end());
+
+        std::string delta;
+        auto append = [&delta](const void *data, size_t size) { delta.append((const char *) data, size); };
+        append(&size_data_per_element_, sizeof(size_data_per_element_));
+        append(&max_elements_, sizeof(max_elements_));
+        size_t element_count = cur_element_count;
+        append(&element_count, sizeof(element_count));
+        append(&maxlevel_, sizeof(maxlevel_));
+        append(&enterpoint_node_, sizeof(enterpoint_node_));
+        size_t count = ids.size();
+        append(&count, sizeof(count));
+
+        for (tableint id : ids) {
+            append(&id, sizeof(id));
+            append(data_level0_memory_ + id * size_data_per_element_, size_data_per_element_);
+            unsigned int linkListSize = element_levels_[id] > 0 ? size_links_per_element_ * element_levels_[id] : 0;
+            append(&linkListSize, sizeof(linkListSize));
+            if (linkListSize)
+                append(linkLists_[id], linkListSize);
+        }
+        const uint32_t crc = crc32Update(0, delta.data(), delta.size());
+
+        std::ofstream output(location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+        output.write(DELTA_MAGIC, sizeof(char[8]));
+        writeBinaryPOD(output, DELTA_FORMAT_VERSION);
+        writeBinaryPOD(output, INDEX_BYTE_ORDER_MARK);
+        writeBinaryPOD(output, crc);
+        output.write(delta.data(), delta.size());
+        output.close();
+        if (!output)
+            throw std::runtime_error("Failed to write the index delta");
+        dirty_elements_.clear();
+    }
+
+
+    /*
+    * Applies a delta written by saveDelta.  The whole delta is read and validated first (version, checksum,
+    * sizes, levels, entry point and neighbor ids), a delta that fails leaves the index unchanged.
+    */
+    void loadDelta(const std::string &location) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        char magic[8] = {};
+        uint32_t version, byte_order, crc;
+        input.read(magic, sizeof(magic));
+        readBinaryPOD(input, version);
+        readBinaryPOD(input, byte_order);
+        readBinaryPOD(input, crc);
+        if (!input || memcmp(magic, DELTA_MAGIC, sizeof(magic)) != 0)
+            throw std::runtime_error("Index delta seems to be corrupted or unsupported");
+        if (byte_order != INDEX_BYTE_ORDER_MARK)
+            throw std::runtime_error("Index delta was saved on a machine with a different byte order");
+        if (version != DELTA_FORMAT_VERSION)
+            throw std::runtime_error("Unsupported index delta format version " + std::to_string(version));
+
+        std::vector<char> delta((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        input.close();
+        const size_t body_size = delta.size();
+        if (crc32Update(0, delta.data(), body_size) != crc)
+            throw std::runtime_error("Index delta seems to be corrupted");
+
+        size_t pos = 0;
+        auto read = [&](void *dst, size_t size) {
+            if (size > body_size - pos) return false;
+            memcpy(dst, delta.data() + pos, size);
+            pos += size;
+            return true;
+        };
+        auto skip = [&](const char *&dst, size_t size) {
+            if (size > body_size - pos) return false;
+            dst = delta.data() + pos;
+            pos += size;
+            return true;
+        };
+
+        size_t size_data_per_element, max_elements, element_count, count;
+        int maxlevel;
+        tableint enterpoint_node;
+        if (!read(&size_data_per_element, sizeof(size_data_per_element)) || !read(&max_elements, sizeof(max_elements)) ||
+            !read(&element_count, sizeof(element_count)) || !read(&maxlevel, sizeof(maxlevel)) ||
+            !read(&enterpoint_node, sizeof(enterpoint_node)) || !read(&count, sizeof(count)))
+            throw std::runtime_error("Index delta seems to be corrupted");
+        if (size_data_per_element != size_data_per_element_ || element_count > max_elements ||
+            element_count < cur_element_count || maxlevel < -1 ||
+            (element_count > 0 && (maxlevel < 0 || enterpoint_node >= element_count)))
+            throw std::runtime_error("Index delta does not match the index");
+
+        struct DeltaRecord {
+            tableint id;
+            int level;
+            const char *data;
+            const char *link_lists;
+        };
+        std::vector<DeltaRecord> records;
+        std::vector<char> added(element_count - cur_element_count, 0);
+        int enterpoint_level = element_count > 0 && enterpoint_node < cur_element_count ? element_levels_[enterpoint_node] : -1;
+        for (size_t i = 0; i < count; i++) {
+            DeltaRecord record;
+            unsigned int linkListSize;
+            if (!read(&record.id, sizeof(record.id)) || record.id >= element_count ||
+                !skip(record.data, size_data_per_element_) || !read(&linkListSize, sizeof(linkListSize)) ||
+                linkListSize % size_links_per_element_ != 0 || !skip(record.link_lists, linkListSize))
+                throw std::runtime_error("Index delta seems to be corrupted");
+            record.level = linkListSize / size_links_per_element_;
+            if (record.level > maxlevel || !validDeltaLinkList(record.data + offsetLevel0_, maxM0_, element_count))
+                throw std::runtime_error("Index delta seems to be corrupted");
+            for (int level = 1; level <= record.level; level++) {
+                if (!validDeltaLinkList(record.link_lists + (level - 1) * size_links_per_element_, maxM_, element_count))
+                    throw std::runtime_error("Index delta seems to be corrupted");
             }
+            if (record.id >= cur_element_count) added[record.id - cur_element_count] = 1;
+            if (record.id == enterpoint_node) enterpoint_level = record.level;
+            records.push_back(record);
         }
+        // every new element is in the delta and the entry point is on the top level
+        if (pos != body_size || std::find(added.begin(), added.end(), 0) != added.end() ||
+            (element_count > 0 && enterpoint_level != maxlevel))
+            throw std::runtime_error("Index delta seems to be corrupted");
+
+        if (max_elements > max_elements_)
+            resizeIndex(max_elements);
+        for (size_t i = cur_element_count; i < element_count; i++) {
+            element_levels_[i] = 0;
+            linkLists_[i] = nullptr;
+        }
+
+        for (const DeltaRecord &record : records) {
+            memcpy(data_level0_memory_ + record.id * size_data_per_element_, record.data, size_data_per_element_);
+            // an element keeps its level, its lists are overwritten in place; a new element gets arena space
+            const size_t linkListSize = size_links_per_element_ * record.level;
+            if (record.level != element_levels_[record.id])
+                linkLists_[record.id] = record.level > 0 ? link_list_arena_.allocate(linkListSize) : nullptr;
+            element_levels_[record.id] = record.level;
+            if (linkListSize)
+                memcpy(linkLists_[record.id], record.link_lists, linkListSize);
+        }
+
+        cur_element_count = element_count;
+        maxlevel_ = maxlevel;
+        enterpoint_node_ = enterpoint_node;
 
+        // labels and delete marks may have changed anywhere in the delta
+        label_lookup_.clear();
+        deleted_elements.clear();
+        num_deleted_ = 0;
         for (size_t i = 0; i < cur_element_count; i++) {
+            label_lookup_.assign(getExternalLabel(i), i);
             if (isMarkedDeleted(i)) {
                 num_deleted_ += 1;
-                if (allow_replace_deleted_) deleted_elements.insert(i);
+                deleted_elements.insert(i);
             }
         }
+    }
 
-        input.close();
 
-        return;
+    // a link list of a delta record: at most max_links neighbors, all of them below element_count
+    bool validDeltaLinkList(const char *list, size_t max_links, size_t element_count) const {
+        unsigned short int size;
+        memcpy(&size, list, sizeof(size));
+        if (size > max_links) return false;
+        for (size_t j = 0; j < size; j++) {
+            tableint neighbor;
+            memcpy(&neighbor, list + sizeof(linklistsizeint) + j * sizeof(tableint), sizeof(tableint));
+            if (neighbor >= element_count) return false;
+        }
+        return true;
     }
 
 
@@ -789,10 +1571,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
             *ll_cur |= DELETE_MARK;
             num_deleted_ += 1;
-            if (allow_replace_deleted_) {
-                std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
-                deleted_elements.insert(internalId);
-            }
+            markDirty(internalId);
+            std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
+            deleted_elements.insert(internalId);
         } else {
             throw std::runtime_error("The requested to delete element is already deleted");
         }
@@ -831,16 +1612,30 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
             *ll_cur &= ~DELETE_MARK;
             num_deleted_ -= 1;
-            if (allow_replace_deleted_) {
-                std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
-                deleted_elements.erase(internalId);
-            }
+            markDirty(internalId);
+            std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
+            deleted_elements.erase(internalId);
         } else {
             throw std::runtime_error("The requested to undelete element is not deleted");
         }
     }
 
 
+    /*
+    * Labels of the live elements, or of the elements marked deleted, in internal id order.
+    * A single pass over the level 0 blocks, the label lookup is not walked.
+    */
+    std::vector<labeltype> getLabels(bool deleted) const {
+        std::vector<labeltype> labels;
+        labels.reserve(deleted ? num_deleted_.load() : cur_element_count - num_deleted_);
+        for (tableint i = 0; i < cur_element_count; i++) {
+            if (isMarkedDeleted(i) == deleted)
+                labels.push_back(getExternalLabel(i));
+        }
+        return labels;
+    }
+
+
     /*
     * Checks the first 16 bits of the memory to see if the element is marked deleted.
     */
@@ -875,12 +1670,29 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             addPoint(data_point, label, -1);
             return;
         }
+        // a label that is still mapped takes its own element back: replacing another deleted element would leave
+        // two elements with the label and drop the label of the replaced one from the lookup
+        bool is_mapped = false;
+        tableint mapped_id = 0;
+        {
+            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+            auto search = label_lookup_.find(label);
+            if (search != label_lookup_.end()) {
+                is_mapped = true;
+                mapped_id = search->second;
+            }
+        }
+        if (is_mapped && !isMarkedDeleted(mapped_id)) {
+            addPoint(data_point, label, -1);
+            return;
+        }
+
         // check if there is vacant place
         tableint internal_id_replaced;
         std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
         bool is_vacant_place = !deleted_elements.empty();
         if (is_vacant_place) {
-            internal_id_replaced = *deleted_elements.begin();
+            internal_id_replaced = is_mapped && deleted_elements.contains(mapped_id) ? mapped_id : deleted_elements.first();
             deleted_elements.erase(internal_id_replaced);
         }
         lock_deleted_elements.unlock();
@@ -896,7 +1708,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
             std::unique_lock <std::mutex> lock_table(label_lookup_lock);
             label_lookup_.erase(label_replaced);
-            label_lookup_[label] = internal_id_replaced;
+            label_lookup_.assign(label, internal_id_replaced);
             lock_table.unlock();
 
             unmarkDeletedInternal(internal_id_replaced);
@@ -908,6 +1720,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     void updatePoint(const void *dataPoint, tableint internalId, float updateNeighborProbability) {
         // update the feature vector associated with existing point with new vector
         memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
+        markDirty(internalId);
 
         int maxLevelCopy = maxlevel_;
         tableint entryPointCopy = enterpoint_node_;
@@ -944,7 +1757,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 // if (neigh == internalId)
                 //     continue;
 
-                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+                SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> candidates;
                 size_t size = sCand.find(neigh) == sCand.end() ? sCand.size() : sCand.size() - 1;  // sCand guaranteed to have size >= 1
                 size_t elementsToKeep = std::min(ef_construction_, size);
                 for (auto&& cand : sCand) {
@@ -967,6 +1780,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                 {
                     std::unique_lock <std::mutex> lock(link_list_locks_[neigh]);
+                    markDirty(neigh);
                     linklistsizeint *ll_cur;
                     ll_cur = get_linklist_at_level(neigh, layer);
                     size_t candSize = candidates.size();
@@ -1025,10 +1839,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             throw std::runtime_error("Level of item to be updated cannot be bigger than max level");
 
         for (int level = dataPointLevel; level >= 0; level--) {
-            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> topCandidates = searchBaseLayer(
+            SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> topCandidates = searchBaseLayer(
                     currObj, dataPoint, level);
 
-            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> filteredTopCandidates;
+            SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> filteredTopCandidates;
             while (topCandidates.size() > 0) {
                 if (topCandidates.top().second != dataPointInternalId)
                     filteredTopCandidates.push(topCandidates.top());
@@ -1093,7 +1907,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
             cur_c = cur_element_count;
             cur_element_count++;
-            label_lookup_[label] = cur_c;
+            label_lookup_.assign(label, cur_c);
         }
 
         std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
@@ -1115,12 +1929,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // Initialisation of the data and label
         memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
         memcpy(getDataByInternalId(cur_c), data_point, data_size_);
+        markDirty(cur_c);
 
         if (curlevel) {
-            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
-            if (linkLists_[cur_c] == nullptr)
-                throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
+            linkLists_[cur_c] = link_list_arena_.allocate(size_links_per_element_ * curlevel);
         }
 
         if ((signed)currObj != -1) {
@@ -1156,7 +1968,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 if (level > maxlevelcopy || level < 0)  // possible?
                     throw std::runtime_error("Level error");
 
-                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates = searchBaseLayer(
+                SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> top_candidates = searchBaseLayer(
                         currObj, data_point, level);
                 if (epDeleted) {
                     top_candidates.emplace(fstdistfunc_(data_point, getDataByInternalId(enterpoint_copy), dist_func_param_), enterpoint_copy);
@@ -1182,11 +1994,32 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     std::priority_queue<std::pair<dist_t, labeltype >>
     searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        std::priority_queue<std::pair<dist_t, labeltype >> result;
-        if (cur_element_count == 0) return result;
+        if (cur_element_count == 0) return std::priority_queue<std::pair<dist_t, labeltype >>();
+
+        size_t ef = std::max(ef_, k);
+        SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> top_candidates;
+        if (isIdAllowed && filter_fallback_) {
+            // the graph search keeps expanding until it holds ef allowed elements, about ef / selectivity visited
+            // elements with up to maxM0_ distances and filter calls each.  The scan asks the filter about every
+            // element and computes the distances of the allowed ones
+            size_t count = cur_element_count;
+            size_t allowed = estimateAllowedCount(isIdAllowed);
+            double call_cost = isIdAllowed->callCost();
+            double graph_distances = std::min<double>(count, static_cast<double>(ef) * maxM0_ * count / std::max<size_t>(allowed, 1));
+            double graph_cost = graph_distances * (1 + call_cost);
+            double scan_cost = allowed + count * call_cost;
+            if (scan_cost <= graph_cost) {
+                top_candidates = searchAllowedElements(query_data, k, isIdAllowed);
+                return toResult(top_candidates, k);
+            }
+            // the elements the filter rejects take no result slot: ef grows with the square root of 1 / selectivity,
+            // most of the recall of ef / selectivity at a fraction of its cost
+            double factor = std::sqrt(static_cast<double>(count) / std::max<size_t>(allowed, 1));
+            ef = std::min(count, static_cast<size_t>(ef * std::min<double>(MAX_FILTER_EF_FACTOR, factor)));
+        }
 
         tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        dist_t curdist = fstquerydistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
 
         for (int level = maxlevel_; level > 0; level--) {
             bool changed = true;
@@ -1204,7 +2037,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     tableint cand = datal[i];
                     if (cand < 0 || cand > max_elements_)
                         throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+                    dist_t d = fstquerydistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
 
                     if (d < curdist) {
                         curdist = d;
@@ -1215,24 +2048,32 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             }
         }
 
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         if (num_deleted_) {
             top_candidates = searchBaseLayerST<true, true>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+                    currObj, query_data, ef, isIdAllowed);
         } else {
             top_candidates = searchBaseLayerST<false, true>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+                    currObj, query_data, ef, isIdAllowed);
         }
+        return toResult(top_candidates, k);
+    }
+
 
+    /// The k nearest of top_candidates with their labels
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    toResult(SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> &top_candidates, size_t k) const {
         while (top_candidates.size() > k) {
             top_candidates.pop();
         }
+        // popped farthest first, a valid max heap already: the result is built with a single allocation
+        std::vector<std::pair<dist_t, labeltype>> result;
+        result.reserve(top_candidates.size());
         while (top_candidates.size() > 0) {
             std::pair<dist_t, tableint> rez = top_candidates.top();
-            result.push(std::pair<dist_t, labeltype>(rez.first, getExternalLabel(rez.second)));
+            result.emplace_back(rez.first, getExternalLabel(rez.second));
             top_candidates.pop();
         }
-        return result;
+        return std::priority_queue<std::pair<dist_t, labeltype >>(std::less<std::pair<dist_t, labeltype >>(), std::move(result));
     }
 
 
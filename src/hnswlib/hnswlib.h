@@ -9,6 +9,21 @@
 #endif
 #endif
 #endif
+#if defined(__wasm_simd128__)
+#define USE_WASM_SIMD
+#endif
+#endif
+
+#if defined(USE_WASM_SIMD)
+#include <wasm_simd128.h>
+#endif
+
+// searchBaseLayerST first gathers the unvisited neighbors of a node and then computes their distances in one
+// batch, the loads of the vectors overlap without _mm_prefetch (wasm) and the batch kernels of the space reuse
+// the query.  -DHNSW_NO_GATHER_SEARCH restores the interleaved loop with prefetches on x86, the benches compare
+// both with make bench-wasm BENCH_CFLAGS=-DHNSW_NO_GATHER_SEARCH (or bench-native)
+#if !defined(HNSW_NO_GATHER_SEARCH) && !defined(HNSW_GATHER_SEARCH)
+#define HNSW_GATHER_SEARCH
 #endif
 
 #if defined(USE_AVX) || defined(USE_SSE)
@@ -119,6 +134,9 @@ typedef size_t labeltype;
 class BaseFilterFunctor {
  public:
     virtual bool operator()(hnswlib::labeltype id) { return true; }
+    // cost of a call in distance computations: filtered searches sample fewer labels of expensive filters
+    // and weigh the scan of the allowed elements with it
+    virtual float callCost() const { return 0.125f; }
 };
 
 template <typename T>
@@ -139,9 +157,45 @@ static void readBinaryPOD(std::istream &in, T &podRef) {
     in.read((char *) &podRef, sizeof(T));
 }
 
+// CRC-32 (IEEE 802.3, as zlib), slicing by 8 bytes.  Start with crc = 0 and feed the buffers in order.
+static uint32_t crc32Update(uint32_t crc, const void *data, size_t length) {
+    struct Tables {
+        uint32_t t[8][256];
+        Tables() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; i++) {
+                for (int k = 1; k < 8; k++) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+            }
+        }
+    };
+    static const Tables tables;
+    const uint32_t (*t)[256] = tables.t;
+
+    const unsigned char *p = (const unsigned char *) data;
+    crc = ~crc;
+    for (; length >= 8; length -= 8, p += 8) {
+        uint32_t one = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+        uint32_t two = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t) p[7] << 24);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+            t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+    }
+    for (; length > 0; length--, p++) {
+        crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
 template<typename MTYPE>
 using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+// Distances of one vector (first argument) to count vectors: out[i] = distance to vectors[i]
+template<typename MTYPE>
+using BATCHDISTFUNC = void(*)(const void *, const void *const *, size_t, const void *, MTYPE *);
+
 template<typename MTYPE>
 class SpaceInterface {
  public:
@@ -152,6 +206,22 @@ class SpaceInterface {
 
     virtual void *get_dist_func_param() = 0;
 
+    // Distance between a search query and a stored element, the query is passed as the first argument.
+    // Spaces whose queries are not stored elements (e.g. a PQ lookup table) override it, construction keeps using get_dist_func.
+    virtual DISTFUNC<MTYPE> get_query_dist_func() {
+        return get_dist_func();
+    }
+
+    // Optional batch versions of get_dist_func and get_query_dist_func, nullptr makes the algorithms call the
+    // single pair function in a loop.  A space overriding get_query_dist_func overrides both or neither.
+    virtual BATCHDISTFUNC<MTYPE> get_batch_dist_func() {
+        return nullptr;
+    }
+
+    virtual BATCHDISTFUNC<MTYPE> get_batch_query_dist_func() {
+        return get_batch_dist_func();
+    }
+
     virtual ~SpaceInterface() {}
 };
 
@@ -195,5 +265,7 @@ AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t
 
 #include "space_l2.h"
 #include "space_ip.h"
+#include "space_sq8.h"
+#include "space_pq.h"
 #include "bruteforce.h"
 #include "hnswalg.h"
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "hnswlib.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace hnswlib {
+typedef unsigned int tableint;
+
+///////////////////////////////////////////////////////////
+//
+// Open addressing map from labels to internal ids, the label lookup of HierarchicalNSW.
+// Keys and values are kept in two flat arrays (linear probing, Fibonacci hashing),
+// a lookup touches one or two cache lines instead of chasing a node pointer.
+// Erase shifts the following entries back, there are no tombstones.
+//
+/////////////////////////////////////////////////////////
+
+class LabelMap {
+ public:
+    static constexpr tableint EMPTY = std::numeric_limits<tableint>::max();
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    typedef std::pair<labeltype, tableint> value_type;
+
+    class iterator {
+     public:
+        iterator(const LabelMap *map, size_t slot) : map_(map), slot_(slot) {
+            skipEmpty();
+        }
+
+        const value_type &operator*() const { return current_; }
+        const value_type *operator->() const { return &current_; }
+
+        iterator &operator++() {
+            slot_++;
+            skipEmpty();
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const { return slot_ == other.slot_; }
+        bool operator!=(const iterator &other) const { return slot_ != other.slot_; }
+
+     private:
+        friend class LabelMap;
+
+        void skipEmpty() {
+            while (slot_ < map_->values_.size() && map_->values_[slot_] == EMPTY) slot_++;
+            if (slot_ < map_->values_.size()) current_ = value_type(map_->keys_[slot_], map_->values_[slot_]);
+        }
+
+        const LabelMap *map_;
+        size_t slot_;
+        value_type current_;
+    };
+
+    LabelMap() {
+        rehash(MIN_CAPACITY);
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    /// slots of the table, a power of two
+    size_t capacity() const { return values_.size(); }
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, values_.size()); }
+
+    iterator find(labeltype label) const {
+        for (size_t slot = home(label);; slot = (slot + 1) & mask_) {
+            if (values_[slot] == EMPTY) return end();
+            if (keys_[slot] == label) return iterator(this, slot);
+        }
+    }
+
+    size_t count(labeltype label) const {
+        return find(label) == end() ? 0 : 1;
+    }
+
+    /// Maps label to internalId, replacing the previous id of the label
+    void assign(labeltype label, tableint internalId) {
+        if ((size_ + 1) * 4 > capacity() * 3) rehash(capacity() * 2);
+        size_t slot = home(label);
+        for (; values_[slot] != EMPTY; slot = (slot + 1) & mask_) {
+            if (keys_[slot] == label) {
+                values_[slot] = internalId;
+                return;
+            }
+        }
+        keys_[slot] = label;
+        values_[slot] = internalId;
+        size_++;
+    }
+
+    size_t erase(labeltype label) {
+        size_t slot = home(label);
+        for (; values_[slot] != EMPTY; slot = (slot + 1) & mask_) {
+            if (keys_[slot] == label) break;
+        }
+        if (values_[slot] == EMPTY) return 0;
+
+        // backward shift: move up every following entry whose home slot is not between the hole and itself
+        size_t hole = slot;
+        for (size_t next = (hole + 1) & mask_; values_[next] != EMPTY; next = (next + 1) & mask_) {
+            size_t want = home(keys_[next]);
+            if (((next - want) & mask_) >= ((next - hole) & mask_)) {
+                keys_[hole] = keys_[next];
+                values_[hole] = values_[next];
+                hole = next;
+            }
+        }
+        values_[hole] = EMPTY;
+        size_--;
+        return 1;
+    }
+
+    void clear() {
+        std::fill(values_.begin(), values_.end(), EMPTY);
+        size_ = 0;
+    }
+
+    /// Sizes the table for count labels without a rehash on the way
+    void reserve(size_t count) {
+        size_t capacity = MIN_CAPACITY;
+        while (capacity * 3 < count * 4) capacity *= 2;
+        if (capacity > this->capacity()) rehash(capacity);
+    }
+
+    /// The table as stored in the index file: capacity keys, then capacity ids (EMPTY for a free slot)
+    const std::vector<labeltype> &keys() const { return keys_; }
+    const std::vector<tableint> &values() const { return values_; }
+
+    /// Byte size of keys and values of a table of capacity slots
+    static size_t tableSize(size_t capacity) {
+        return capacity * (sizeof(labeltype) + sizeof(tableint));
+    }
+
+    /// Takes a stored table (capacity keys, then capacity ids) as is.  Returns false, leaving the map empty, unless the
+    /// capacity is a power of two and the ids are below maxId
+    bool loadTable(const char *data, size_t capacity, tableint maxId) {
+        clear();
+        if (capacity < MIN_CAPACITY || (capacity & (capacity - 1)) != 0) return false;
+        rehash(capacity);
+        memcpy(keys_.data(), data, capacity * sizeof(labeltype));
+        memcpy(values_.data(), data + capacity * sizeof(labeltype), capacity * sizeof(tableint));
+        size_ = 0;
+        for (tableint value : values_) {
+            if (value == EMPTY) continue;
+            if (value >= maxId) {
+                clear();
+                return false;
+            }
+            size_++;
+        }
+        return size_ * 4 <= capacity * 3;
+    }
+
+    bool operator==(const LabelMap &other) const {
+        if (size_ != other.size_) return false;
+        for (const value_type &entry : *this) {
+            iterator found = other.find(entry.first);
+            if (found == other.end() || found->second != entry.second) return false;
+        }
+        return true;
+    }
+
+    bool operator!=(const LabelMap &other) const { return !(*this == other); }
+
+ private:
+    size_t home(labeltype label) const {
+        return static_cast<size_t>((static_cast<uint64_t>(label) * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<labeltype> keys(capacity);
+        std::vector<tableint> values(capacity, EMPTY);
+        keys.swap(keys_);
+        values.swap(values_);
+        mask_ = capacity - 1;
+        shift_ = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) shift_--;
+        size_ = 0;
+        for (size_t slot = 0; slot < values.size(); slot++) {
+            if (values[slot] != EMPTY) assign(keys[slot], values[slot]);
+        }
+    }
+
+    std::vector<labeltype> keys_;
+    std::vector<tableint> values_;
+    size_t size_{0};
+    size_t mask_{0};
+    unsigned int shift_{64};
+};
+
+
+///////////////////////////////////////////////////////////
+//
+// Set of internal ids as a bitset, the deleted elements of HierarchicalNSW.
+// The words are the DELETED section of the index file.
+//
+/////////////////////////////////////////////////////////
+
+class ElementBitset {
+ public:
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    bool contains(tableint internalId) const {
+        size_t word = internalId / 64;
+        return word < words_.size() && ((words_[word] >> (internalId % 64)) & 1);
+    }
+
+    void insert(tableint internalId) {
+        size_t word = internalId / 64;
+        if (word >= words_.size()) words_.resize(word + 1, 0);
+        uint64_t bit = uint64_t(1) << (internalId % 64);
+        if (words_[word] & bit) return;
+        words_[word] |= bit;
+        size_++;
+        if (word < first_word_) first_word_ = word;
+    }
+
+    size_t erase(tableint internalId) {
+        if (!contains(internalId)) return 0;
+        words_[internalId / 64] &= ~(uint64_t(1) << (internalId % 64));
+        size_--;
+        return 1;
+    }
+
+    void clear() {
+        words_.clear();
+        size_ = 0;
+        first_word_ = 0;
+    }
+
+    /// The lowest id in the set, the set must not be empty
+    tableint first() const {
+        while (words_[first_word_] == 0) first_word_++;
+        uint64_t word = words_[first_word_];
+        tableint bit = 0;
+        while ((word & 1) == 0) {
+            word >>= 1;
+            bit++;
+        }
+        return static_cast<tableint>(first_word_ * 64) + bit;
+    }
+
+    const std::vector<uint64_t> &words() const { return words_; }
+
+    /// Replaces the set with the given words, bit i of word i / 64 for id i
+    void assignWords(const uint64_t *words, size_t count) {
+        words_.assign(words, words + count);
+        size_ = 0;
+        for (uint64_t word : words_) {
+            for (; word != 0; word &= word - 1) size_++;
+        }
+        first_word_ = 0;
+    }
+
+ private:
+    std::vector<uint64_t> words_;
+    size_t size_{0};
+    /// no word below it has a bit set
+    mutable size_t first_word_{0};
+};
+
+}  // namespace hnswlib
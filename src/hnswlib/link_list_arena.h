@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace hnswlib {
+
+///////////////////////////////////////////////////////////
+//
+// Storage of the upper layer link lists of HierarchicalNSW.  Lists are carved out of a few large
+// chunks instead of one malloc per element; chunks never move, so a list stays put while other
+// threads insert.  Memory is only returned all at once by clear().
+//
+/////////////////////////////////////////////////////////
+
+class LinkListArena {
+    static constexpr size_t MIN_CHUNK_SIZE = 16 * 1024;
+    static constexpr size_t MAX_CHUNK_SIZE = 1024 * 1024;
+
+    std::vector<char *> chunks_;
+    char *current_{nullptr};
+    size_t used_{0};
+    size_t capacity_{0};
+    size_t allocated_{0};
+    std::mutex lock_;
+
+    char *newChunk(size_t size) {
+        char *chunk = (char *) malloc(size);
+        if (chunk == nullptr)
+            throw std::runtime_error("Not enough memory: failed to allocate link lists");
+        chunks_.push_back(chunk);
+        return chunk;
+    }
+
+ public:
+    LinkListArena() {}
+    LinkListArena(const LinkListArena &) = delete;
+    LinkListArena &operator=(const LinkListArena &) = delete;
+
+    ~LinkListArena() {
+        clear();
+    }
+
+    /// size zeroed bytes, 8 byte aligned.  Thread safe
+    char *allocate(size_t size) {
+        size = (size + 7) & ~size_t(7);
+        std::unique_lock <std::mutex> lock(lock_);
+        if (size > capacity_ - used_) {
+            // chunks grow with the index, small indexes do not reserve a megabyte
+            size_t chunk_size = std::min(MAX_CHUNK_SIZE, std::max(MIN_CHUNK_SIZE, 2 * capacity_));
+            if (chunk_size < size) chunk_size = size;
+            current_ = newChunk(chunk_size);
+            used_ = 0;
+            capacity_ = chunk_size;
+        }
+        char *list = current_ + used_;
+        used_ += size;
+        allocated_ += size;
+        lock.unlock();
+        memset(list, 0, size);
+        return list;
+    }
+
+    /// A chunk of exactly size bytes for the link lists of a whole index, filled by the caller.
+    /// Later allocations do not share it
+    char *allocateBlock(size_t size) {
+        std::unique_lock <std::mutex> lock(lock_);
+        allocated_ += size;
+        return newChunk(size == 0 ? 1 : size);
+    }
+
+    /// Bytes handed out by allocate and allocateBlock
+    size_t allocatedBytes() const {
+        return allocated_;
+    }
+
+    void clear() {
+        std::unique_lock <std::mutex> lock(lock_);
+        for (char *chunk : chunks_) free(chunk);
+        chunks_.clear();
+        current_ = nullptr;
+        used_ = 0;
+        capacity_ = 0;
+        allocated_ = 0;
+    }
+};
+
+}  // namespace hnswlib
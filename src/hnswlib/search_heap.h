@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace hnswlib {
+
+///////////////////////////////////////////////////////////
+//
+// Scratch storage of the searches.  A SearchBuffer takes its vector from a per thread list of
+// spares and gives it back (cleared, capacity kept) when it is destroyed, so after the first
+// queries of a thread a search does not allocate.  Nested searches (e.g. from a filter callback)
+// simply take another spare.
+//
+/////////////////////////////////////////////////////////
+
+template<typename T>
+class SearchBuffer {
+    static constexpr size_t MAX_SPARES = 16;
+
+    static std::vector<std::vector<T>> &spares() {
+        static thread_local std::vector<std::vector<T>> spares;
+        return spares;
+    }
+
+    void release() {
+        if (data.capacity() == 0) return;
+        std::vector<std::vector<T>> &list = spares();
+        if (list.size() < MAX_SPARES) {
+            data.clear();
+            list.push_back(std::move(data));
+        }
+        data = std::vector<T>();
+    }
+
+ public:
+    std::vector<T> data;
+
+    SearchBuffer() {
+        std::vector<std::vector<T>> &list = spares();
+        if (!list.empty()) {
+            data = std::move(list.back());
+            list.pop_back();
+        }
+    }
+
+    explicit SearchBuffer(size_t size) : SearchBuffer() {
+        data.resize(size);
+    }
+
+    SearchBuffer(SearchBuffer &&other) noexcept : data(std::move(other.data)) {}
+
+    SearchBuffer &operator=(SearchBuffer &&other) noexcept {
+        if (this != &other) {
+            release();
+            data = std::move(other.data);
+        }
+        return *this;
+    }
+
+    SearchBuffer(const SearchBuffer &) = delete;
+    SearchBuffer &operator=(const SearchBuffer &) = delete;
+
+    ~SearchBuffer() {
+        release();
+    }
+};
+
+
+///////////////////////////////////////////////////////////
+//
+// Binary heap with the interface of std::priority_queue on a SearchBuffer, the candidate and
+// result queues of the searches.
+//
+/////////////////////////////////////////////////////////
+
+template<typename T, typename Compare>
+class SearchHeap {
+    SearchBuffer<T> buffer_;
+    Compare compare_;
+
+ public:
+    bool empty() const { return buffer_.data.empty(); }
+    size_t size() const { return buffer_.data.size(); }
+    const T &top() const { return buffer_.data.front(); }
+
+    /// Sizes the storage for count elements, e.g. ef + 1 for the results of a search
+    void reserve(size_t count) {
+        buffer_.data.reserve(count);
+    }
+
+    void push(const T &value) {
+        buffer_.data.push_back(value);
+        std::push_heap(buffer_.data.begin(), buffer_.data.end(), compare_);
+    }
+
+    template<typename... Args>
+    void emplace(Args &&... args) {
+        buffer_.data.emplace_back(std::forward<Args>(args)...);
+        std::push_heap(buffer_.data.begin(), buffer_.data.end(), compare_);
+    }
+
+    void pop() {
+        std::pop_heap(buffer_.data.begin(), buffer_.data.end(), compare_);
+        buffer_.data.pop_back();
+    }
+};
+
+}  // namespace hnswlib
@@ -314,8 +314,262 @@ InnerProductDistanceSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v,
 }
 #endif
 
+#if defined(USE_WASM_SIMD)
+
+// WebAssembly simd128, used when building with emcc -msimd128.
+static float
+InnerProductSIMD16ExtWasm(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    size_t qty16 = qty / 16;
+
+    const float *pEnd1 = pVect1 + 16 * qty16;
+
+    v128_t v1, v2;
+    v128_t sum_prod0 = wasm_f32x4_splat(0);
+    v128_t sum_prod1 = wasm_f32x4_splat(0);
+
+    while (pVect1 < pEnd1) {
+        v1 = wasm_v128_load(pVect1);
+        v2 = wasm_v128_load(pVect2);
+        sum_prod0 = wasm_f32x4_add(sum_prod0, wasm_f32x4_mul(v1, v2));
+
+        v1 = wasm_v128_load(pVect1 + 4);
+        v2 = wasm_v128_load(pVect2 + 4);
+        sum_prod1 = wasm_f32x4_add(sum_prod1, wasm_f32x4_mul(v1, v2));
+
+        v1 = wasm_v128_load(pVect1 + 8);
+        v2 = wasm_v128_load(pVect2 + 8);
+        sum_prod0 = wasm_f32x4_add(sum_prod0, wasm_f32x4_mul(v1, v2));
+
+        v1 = wasm_v128_load(pVect1 + 12);
+        v2 = wasm_v128_load(pVect2 + 12);
+        sum_prod1 = wasm_f32x4_add(sum_prod1, wasm_f32x4_mul(v1, v2));
+
+        pVect1 += 16;
+        pVect2 += 16;
+    }
+
+    v128_t sum_prod = wasm_f32x4_add(sum_prod0, sum_prod1);
+    return wasm_f32x4_extract_lane(sum_prod, 0) + wasm_f32x4_extract_lane(sum_prod, 1) +
+            wasm_f32x4_extract_lane(sum_prod, 2) + wasm_f32x4_extract_lane(sum_prod, 3);
+}
+
+static float
+InnerProductSIMD4ExtWasm(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    size_t qty4 = qty / 4;
+
+    const float *pEnd1 = pVect1 + 4 * qty4;
+
+    v128_t v1, v2;
+    v128_t sum_prod = wasm_f32x4_splat(0);
+
+    while (pVect1 < pEnd1) {
+        v1 = wasm_v128_load(pVect1);
+        pVect1 += 4;
+        v2 = wasm_v128_load(pVect2);
+        pVect2 += 4;
+        sum_prod = wasm_f32x4_add(sum_prod, wasm_f32x4_mul(v1, v2));
+    }
+
+    return wasm_f32x4_extract_lane(sum_prod, 0) + wasm_f32x4_extract_lane(sum_prod, 1) +
+            wasm_f32x4_extract_lane(sum_prod, 2) + wasm_f32x4_extract_lane(sum_prod, 3);
+}
+
+static float
+InnerProductDistanceSIMD16ExtWasm(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSIMD16ExtWasm(pVect1v, pVect2v, qty_ptr);
+}
+
+static float
+InnerProductDistanceSIMD4ExtWasm(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSIMD4ExtWasm(pVect1v, pVect2v, qty_ptr);
+}
+
+static float
+InnerProductDistanceSIMD16ExtWasmResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    float res = InnerProductSIMD16ExtWasm(pVect1v, pVect2v, &qty16);
+    float *pVect1 = (float *) pVect1v + qty16;
+    float *pVect2 = (float *) pVect2v + qty16;
+
+    // handle the 4 wide part of the tail before falling back to the scalar loop
+    size_t qty_left = qty - qty16;
+    size_t qty4 = qty_left >> 2 << 2;
+    float res_tail = InnerProductSIMD4ExtWasm(pVect1, pVect2, &qty4);
+    qty_left -= qty4;
+    res_tail += InnerProduct(pVect1 + qty4, pVect2 + qty4, &qty_left);
+    return 1.0f - (res + res_tail);
+}
+
+static float
+InnerProductDistanceSIMD4ExtWasmResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+
+    float res = InnerProductSIMD4ExtWasm(pVect1v, pVect2v, &qty4);
+    size_t qty_left = qty - qty4;
+
+    float *pVect1 = (float *) pVect1v + qty4;
+    float *pVect2 = (float *) pVect2v + qty4;
+    float res_tail = InnerProduct(pVect1, pVect2, &qty_left);
+
+    return 1.0f - (res + res_tail);
+}
+#endif
+
+// Batch kernels: one query against count vectors, out[i] = 1 - <query, vectors[i]>.  Four vectors are processed
+// together, every load of the query feeds four accumulators
+static void
+InnerProductDistanceBatch(const void *pVect1v, const void *const *pVects, size_t count, const void *qty_ptr, float *out) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = InnerProductDistance(pVect1v, pVects[i], qty_ptr);
+    }
+}
+
+#if defined(USE_AVX)
+
+static void
+InnerProductDistanceBatchAVX(const void *pVect1v, const void *const *pVects, size_t count, const void *qty_ptr, float *out) {
+    const float *pVect1 = (const float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty8 = qty >> 3 << 3;
+    size_t qty_left = qty - qty8;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float *a = (const float *) pVects[i];
+        const float *b = (const float *) pVects[i + 1];
+        const float *c = (const float *) pVects[i + 2];
+        const float *d = (const float *) pVects[i + 3];
+        __m256 sum_a = _mm256_set1_ps(0), sum_b = _mm256_set1_ps(0), sum_c = _mm256_set1_ps(0), sum_d = _mm256_set1_ps(0);
+        for (size_t j = 0; j < qty8; j += 8) {
+            __m256 q = _mm256_loadu_ps(pVect1 + j);
+            sum_a = _mm256_add_ps(sum_a, _mm256_mul_ps(q, _mm256_loadu_ps(a + j)));
+            sum_b = _mm256_add_ps(sum_b, _mm256_mul_ps(q, _mm256_loadu_ps(b + j)));
+            sum_c = _mm256_add_ps(sum_c, _mm256_mul_ps(q, _mm256_loadu_ps(c + j)));
+            sum_d = _mm256_add_ps(sum_d, _mm256_mul_ps(q, _mm256_loadu_ps(d + j)));
+        }
+        __m256 sums[4] = {sum_a, sum_b, sum_c, sum_d};
+        for (size_t k = 0; k < 4; k++) {
+            _mm256_store_ps(TmpRes, sums[k]);
+            out[i + k] = 1.0f - (TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] +
+                    InnerProduct(pVect1 + qty8, (const float *) pVects[i + k] + qty8, &qty_left));
+        }
+    }
+    for (; i < count; i++) {
+        const float *a = (const float *) pVects[i];
+        __m256 sum = _mm256_set1_ps(0);
+        for (size_t j = 0; j < qty8; j += 8) {
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + j), _mm256_loadu_ps(a + j)));
+        }
+        _mm256_store_ps(TmpRes, sum);
+        out[i] = 1.0f - (TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] +
+                InnerProduct(pVect1 + qty8, a + qty8, &qty_left));
+    }
+}
+
+#endif
+
+#if defined(USE_SSE)
+
+static void
+InnerProductDistanceBatchSSE(const void *pVect1v, const void *const *pVects, size_t count, const void *qty_ptr, float *out) {
+    const float *pVect1 = (const float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+    size_t qty_left = qty - qty4;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float *a = (const float *) pVects[i];
+        const float *b = (const float *) pVects[i + 1];
+        const float *c = (const float *) pVects[i + 2];
+        const float *d = (const float *) pVects[i + 3];
+        __m128 sum_a = _mm_set1_ps(0), sum_b = _mm_set1_ps(0), sum_c = _mm_set1_ps(0), sum_d = _mm_set1_ps(0);
+        for (size_t j = 0; j < qty4; j += 4) {
+            __m128 q = _mm_loadu_ps(pVect1 + j);
+            sum_a = _mm_add_ps(sum_a, _mm_mul_ps(q, _mm_loadu_ps(a + j)));
+            sum_b = _mm_add_ps(sum_b, _mm_mul_ps(q, _mm_loadu_ps(b + j)));
+            sum_c = _mm_add_ps(sum_c, _mm_mul_ps(q, _mm_loadu_ps(c + j)));
+            sum_d = _mm_add_ps(sum_d, _mm_mul_ps(q, _mm_loadu_ps(d + j)));
+        }
+        __m128 sums[4] = {sum_a, sum_b, sum_c, sum_d};
+        for (size_t k = 0; k < 4; k++) {
+            _mm_store_ps(TmpRes, sums[k]);
+            out[i + k] = 1.0f - (TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] +
+                    InnerProduct(pVect1 + qty4, (const float *) pVects[i + k] + qty4, &qty_left));
+        }
+    }
+    for (; i < count; i++) {
+        const float *a = (const float *) pVects[i];
+        __m128 sum = _mm_set1_ps(0);
+        for (size_t j = 0; j < qty4; j += 4) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pVect1 + j), _mm_loadu_ps(a + j)));
+        }
+        _mm_store_ps(TmpRes, sum);
+        out[i] = 1.0f - (TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + InnerProduct(pVect1 + qty4, a + qty4, &qty_left));
+    }
+}
+
+#endif
+
+#if defined(USE_WASM_SIMD)
+
+static void
+InnerProductDistanceBatchWasm(const void *pVect1v, const void *const *pVects, size_t count, const void *qty_ptr, float *out) {
+    const float *pVect1 = (const float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+    size_t qty_left = qty - qty4;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float *a = (const float *) pVects[i];
+        const float *b = (const float *) pVects[i + 1];
+        const float *c = (const float *) pVects[i + 2];
+        const float *d = (const float *) pVects[i + 3];
+        v128_t sum_a = wasm_f32x4_splat(0), sum_b = wasm_f32x4_splat(0), sum_c = wasm_f32x4_splat(0), sum_d = wasm_f32x4_splat(0);
+        for (size_t j = 0; j < qty4; j += 4) {
+            v128_t q = wasm_v128_load(pVect1 + j);
+            sum_a = wasm_f32x4_add(sum_a, wasm_f32x4_mul(q, wasm_v128_load(a + j)));
+            sum_b = wasm_f32x4_add(sum_b, wasm_f32x4_mul(q, wasm_v128_load(b + j)));
+            sum_c = wasm_f32x4_add(sum_c, wasm_f32x4_mul(q, wasm_v128_load(c + j)));
+            sum_d = wasm_f32x4_add(sum_d, wasm_f32x4_mul(q, wasm_v128_load(d + j)));
+        }
+        v128_t sums[4] = {sum_a, sum_b, sum_c, sum_d};
+        for (size_t k = 0; k < 4; k++) {
+            out[i + k] = 1.0f - (wasm_f32x4_extract_lane(sums[k], 0) + wasm_f32x4_extract_lane(sums[k], 1) +
+                    wasm_f32x4_extract_lane(sums[k], 2) + wasm_f32x4_extract_lane(sums[k], 3) +
+                    InnerProduct(pVect1 + qty4, (const float *) pVects[i + k] + qty4, &qty_left));
+        }
+    }
+    for (; i < count; i++) {
+        const float *a = (const float *) pVects[i];
+        v128_t sum = wasm_f32x4_splat(0);
+        for (size_t j = 0; j < qty4; j += 4) {
+            sum = wasm_f32x4_add(sum, wasm_f32x4_mul(wasm_v128_load(pVect1 + j), wasm_v128_load(a + j)));
+        }
+        out[i] = 1.0f - (wasm_f32x4_extract_lane(sum, 0) + wasm_f32x4_extract_lane(sum, 1) +
+                wasm_f32x4_extract_lane(sum, 2) + wasm_f32x4_extract_lane(sum, 3) +
+                InnerProduct(pVect1 + qty4, a + qty4, &qty_left));
+    }
+}
+
+#endif
+
 class InnerProductSpace : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> batchdistfunc_;
     size_t data_size_;
     size_t dim_;
 
@@ -352,6 +606,30 @@ class InnerProductSpace : public SpaceInterface<float> {
             fstdistfunc_ = InnerProductDistanceSIMD16ExtResiduals;
         else if (dim > 4)
             fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
+#endif
+#if defined(USE_WASM_SIMD)
+        if (dim % 16 == 0)
+            fstdistfunc_ = InnerProductDistanceSIMD16ExtWasm;
+        else if (dim % 4 == 0)
+            fstdistfunc_ = InnerProductDistanceSIMD4ExtWasm;
+        else if (dim > 16)
+            fstdistfunc_ = InnerProductDistanceSIMD16ExtWasmResiduals;
+        else if (dim > 4)
+            fstdistfunc_ = InnerProductDistanceSIMD4ExtWasmResiduals;
+#endif
+
+        batchdistfunc_ = InnerProductDistanceBatch;
+#if defined(USE_SSE)
+        if (dim >= 4)
+            batchdistfunc_ = InnerProductDistanceBatchSSE;
+#endif
+#if defined(USE_AVX)
+        if (dim >= 8 && AVXCapable())
+            batchdistfunc_ = InnerProductDistanceBatchAVX;
+#endif
+#if defined(USE_WASM_SIMD)
+        if (dim >= 4)
+            batchdistfunc_ = InnerProductDistanceBatchWasm;
 #endif
         dim_ = dim;
         data_size_ = dim * sizeof(float);
@@ -365,6 +643,10 @@ class InnerProductSpace : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    BATCHDISTFUNC<float> get_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
@@ -205,8 +205,271 @@ L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty
 }
 #endif
 
+#if defined(USE_WASM_SIMD)
+
+// WebAssembly simd128, used when building with emcc -msimd128.
+static float
+L2SqrSIMD16ExtWasm(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4;
+
+    const float *pEnd1 = pVect1 + (qty16 << 4);
+
+    v128_t diff, v1, v2;
+    // independent accumulators, wasm engines do not reorder float adds
+    v128_t sum0 = wasm_f32x4_splat(0);
+    v128_t sum1 = wasm_f32x4_splat(0);
+
+    while (pVect1 < pEnd1) {
+        v1 = wasm_v128_load(pVect1);
+        v2 = wasm_v128_load(pVect2);
+        diff = wasm_f32x4_sub(v1, v2);
+        sum0 = wasm_f32x4_add(sum0, wasm_f32x4_mul(diff, diff));
+
+        v1 = wasm_v128_load(pVect1 + 4);
+        v2 = wasm_v128_load(pVect2 + 4);
+        diff = wasm_f32x4_sub(v1, v2);
+        sum1 = wasm_f32x4_add(sum1, wasm_f32x4_mul(diff, diff));
+
+        v1 = wasm_v128_load(pVect1 + 8);
+        v2 = wasm_v128_load(pVect2 + 8);
+        diff = wasm_f32x4_sub(v1, v2);
+        sum0 = wasm_f32x4_add(sum0, wasm_f32x4_mul(diff, diff));
+
+        v1 = wasm_v128_load(pVect1 + 12);
+        v2 = wasm_v128_load(pVect2 + 12);
+        diff = wasm_f32x4_sub(v1, v2);
+        sum1 = wasm_f32x4_add(sum1, wasm_f32x4_mul(diff, diff));
+
+        pVect1 += 16;
+        pVect2 += 16;
+    }
+
+    v128_t sum = wasm_f32x4_add(sum0, sum1);
+    return wasm_f32x4_extract_lane(sum, 0) + wasm_f32x4_extract_lane(sum, 1) +
+            wasm_f32x4_extract_lane(sum, 2) + wasm_f32x4_extract_lane(sum, 3);
+}
+
+static float
+L2SqrSIMD4ExtWasm(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2;
+
+    const float *pEnd1 = pVect1 + (qty4 << 2);
+
+    v128_t diff, v1, v2;
+    v128_t sum = wasm_f32x4_splat(0);
+
+    while (pVect1 < pEnd1) {
+        v1 = wasm_v128_load(pVect1);
+        pVect1 += 4;
+        v2 = wasm_v128_load(pVect2);
+        pVect2 += 4;
+        diff = wasm_f32x4_sub(v1, v2);
+        sum = wasm_f32x4_add(sum, wasm_f32x4_mul(diff, diff));
+    }
+
+    return wasm_f32x4_extract_lane(sum, 0) + wasm_f32x4_extract_lane(sum, 1) +
+            wasm_f32x4_extract_lane(sum, 2) + wasm_f32x4_extract_lane(sum, 3);
+}
+
+static float
+L2SqrSIMD16ExtWasmResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    float res = L2SqrSIMD16ExtWasm(pVect1v, pVect2v, &qty16);
+    float *pVect1 = (float *) pVect1v + qty16;
+    float *pVect2 = (float *) pVect2v + qty16;
+
+    // handle the 4 wide part of the tail before falling back to the scalar loop
+    size_t qty_left = qty - qty16;
+    size_t qty4 = qty_left >> 2 << 2;
+    float res_tail = L2SqrSIMD4ExtWasm(pVect1, pVect2, &qty4);
+    qty_left -= qty4;
+    res_tail += L2Sqr(pVect1 + qty4, pVect2 + qty4, &qty_left);
+    return (res + res_tail);
+}
+
+static float
+L2SqrSIMD4ExtWasmResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+
+    float res = L2SqrSIMD4ExtWasm(pVect1v, pVect2v, &qty4);
+    size_t qty_left = qty - qty4;
+
+    float *pVect1 = (float *) pVect1v + qty4;
+    float *pVect2 = (float *) pVect2v + qty4;
+    float res_tail = L2Sqr(pVect1, pVect2, &qty_left);
+
+    return (res + res_tail);
+}
+#endif
+
+// Batch kernels: one query against count vectors.  Four vectors are processed together, every load of the
+// query feeds four accumulators.  The dimensions past the last full register go through L2Sqr.
+static void
+L2SqrBatch(const void *pVect1v, const void *const *pVects, size_t count, const void *qty_ptr, float *out) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = L2Sqr(pVect1v, pVects[i], qty_ptr);
+    }
+}
+
+#if defined(USE_AVX)
+
+static void
+L2SqrBatchAVX(const void *pVect1v, const void *const *pVects, size_t count, const void *qty_ptr, float *out) {
+    const float *pVect1 = (const float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty8 = qty >> 3 << 3;
+    size_t qty_left = qty - qty8;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float *a = (const float *) pVects[i];
+        const float *b = (const float *) pVects[i + 1];
+        const float *c = (const float *) pVects[i + 2];
+        const float *d = (const float *) pVects[i + 3];
+        __m256 sum_a = _mm256_set1_ps(0), sum_b = _mm256_set1_ps(0), sum_c = _mm256_set1_ps(0), sum_d = _mm256_set1_ps(0);
+        for (size_t j = 0; j < qty8; j += 8) {
+            __m256 q = _mm256_loadu_ps(pVect1 + j);
+            __m256 diff = _mm256_sub_ps(q, _mm256_loadu_ps(a + j));
+            sum_a = _mm256_add_ps(sum_a, _mm256_mul_ps(diff, diff));
+            diff = _mm256_sub_ps(q, _mm256_loadu_ps(b + j));
+            sum_b = _mm256_add_ps(sum_b, _mm256_mul_ps(diff, diff));
+            diff = _mm256_sub_ps(q, _mm256_loadu_ps(c + j));
+            sum_c = _mm256_add_ps(sum_c, _mm256_mul_ps(diff, diff));
+            diff = _mm256_sub_ps(q, _mm256_loadu_ps(d + j));
+            sum_d = _mm256_add_ps(sum_d, _mm256_mul_ps(diff, diff));
+        }
+        __m256 sums[4] = {sum_a, sum_b, sum_c, sum_d};
+        for (size_t k = 0; k < 4; k++) {
+            _mm256_store_ps(TmpRes, sums[k]);
+            out[i + k] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] +
+                    L2Sqr(pVect1 + qty8, (const float *) pVects[i + k] + qty8, &qty_left);
+        }
+    }
+    for (; i < count; i++) {
+        const float *a = (const float *) pVects[i];
+        __m256 sum = _mm256_set1_ps(0);
+        for (size_t j = 0; j < qty8; j += 8) {
+            __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + j), _mm256_loadu_ps(a + j));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+        }
+        _mm256_store_ps(TmpRes, sum);
+        out[i] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] +
+                L2Sqr(pVect1 + qty8, a + qty8, &qty_left);
+    }
+}
+
+#endif
+
+#if defined(USE_SSE)
+
+static void
+L2SqrBatchSSE(const void *pVect1v, const void *const *pVects, size_t count, const void *qty_ptr, float *out) {
+    const float *pVect1 = (const float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+    size_t qty_left = qty - qty4;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float *a = (const float *) pVects[i];
+        const float *b = (const float *) pVects[i + 1];
+        const float *c = (const float *) pVects[i + 2];
+        const float *d = (const float *) pVects[i + 3];
+        __m128 sum_a = _mm_set1_ps(0), sum_b = _mm_set1_ps(0), sum_c = _mm_set1_ps(0), sum_d = _mm_set1_ps(0);
+        for (size_t j = 0; j < qty4; j += 4) {
+            __m128 q = _mm_loadu_ps(pVect1 + j);
+            __m128 diff = _mm_sub_ps(q, _mm_loadu_ps(a + j));
+            sum_a = _mm_add_ps(sum_a, _mm_mul_ps(diff, diff));
+            diff = _mm_sub_ps(q, _mm_loadu_ps(b + j));
+            sum_b = _mm_add_ps(sum_b, _mm_mul_ps(diff, diff));
+            diff = _mm_sub_ps(q, _mm_loadu_ps(c + j));
+            sum_c = _mm_add_ps(sum_c, _mm_mul_ps(diff, diff));
+            diff = _mm_sub_ps(q, _mm_loadu_ps(d + j));
+            sum_d = _mm_add_ps(sum_d, _mm_mul_ps(diff, diff));
+        }
+        __m128 sums[4] = {sum_a, sum_b, sum_c, sum_d};
+        for (size_t k = 0; k < 4; k++) {
+            _mm_store_ps(TmpRes, sums[k]);
+            out[i + k] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] +
+                    L2Sqr(pVect1 + qty4, (const float *) pVects[i + k] + qty4, &qty_left);
+        }
+    }
+    for (; i < count; i++) {
+        const float *a = (const float *) pVects[i];
+        __m128 sum = _mm_set1_ps(0);
+        for (size_t j = 0; j < qty4; j += 4) {
+            __m128 diff = _mm_sub_ps(_mm_loadu_ps(pVect1 + j), _mm_loadu_ps(a + j));
+            sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+        }
+        _mm_store_ps(TmpRes, sum);
+        out[i] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + L2Sqr(pVect1 + qty4, a + qty4, &qty_left);
+    }
+}
+
+#endif
+
+#if defined(USE_WASM_SIMD)
+
+static void
+L2SqrBatchWasm(const void *pVect1v, const void *const *pVects, size_t count, const void *qty_ptr, float *out) {
+    const float *pVect1 = (const float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+    size_t qty_left = qty - qty4;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float *a = (const float *) pVects[i];
+        const float *b = (const float *) pVects[i + 1];
+        const float *c = (const float *) pVects[i + 2];
+        const float *d = (const float *) pVects[i + 3];
+        v128_t sum_a = wasm_f32x4_splat(0), sum_b = wasm_f32x4_splat(0), sum_c = wasm_f32x4_splat(0), sum_d = wasm_f32x4_splat(0);
+        for (size_t j = 0; j < qty4; j += 4) {
+            v128_t q = wasm_v128_load(pVect1 + j);
+            v128_t diff = wasm_f32x4_sub(q, wasm_v128_load(a + j));
+            sum_a = wasm_f32x4_add(sum_a, wasm_f32x4_mul(diff, diff));
+            diff = wasm_f32x4_sub(q, wasm_v128_load(b + j));
+            sum_b = wasm_f32x4_add(sum_b, wasm_f32x4_mul(diff, diff));
+            diff = wasm_f32x4_sub(q, wasm_v128_load(c + j));
+            sum_c = wasm_f32x4_add(sum_c, wasm_f32x4_mul(diff, diff));
+            diff = wasm_f32x4_sub(q, wasm_v128_load(d + j));
+            sum_d = wasm_f32x4_add(sum_d, wasm_f32x4_mul(diff, diff));
+        }
+        v128_t sums[4] = {sum_a, sum_b, sum_c, sum_d};
+        for (size_t k = 0; k < 4; k++) {
+            out[i + k] = wasm_f32x4_extract_lane(sums[k], 0) + wasm_f32x4_extract_lane(sums[k], 1) +
+                    wasm_f32x4_extract_lane(sums[k], 2) + wasm_f32x4_extract_lane(sums[k], 3) +
+                    L2Sqr(pVect1 + qty4, (const float *) pVects[i + k] + qty4, &qty_left);
+        }
+    }
+    for (; i < count; i++) {
+        const float *a = (const float *) pVects[i];
+        v128_t sum = wasm_f32x4_splat(0);
+        for (size_t j = 0; j < qty4; j += 4) {
+            v128_t diff = wasm_f32x4_sub(wasm_v128_load(pVect1 + j), wasm_v128_load(a + j));
+            sum = wasm_f32x4_add(sum, wasm_f32x4_mul(diff, diff));
+        }
+        out[i] = wasm_f32x4_extract_lane(sum, 0) + wasm_f32x4_extract_lane(sum, 1) +
+                wasm_f32x4_extract_lane(sum, 2) + wasm_f32x4_extract_lane(sum, 3) +
+                L2Sqr(pVect1 + qty4, a + qty4, &qty_left);
+    }
+}
+
+#endif
+
 class L2Space : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> batchdistfunc_;
     size_t data_size_;
     size_t dim_;
 
@@ -232,6 +495,30 @@ class L2Space : public SpaceInterface<float> {
             fstdistfunc_ = L2SqrSIMD16ExtResiduals;
         else if (dim > 4)
             fstdistfunc_ = L2SqrSIMD4ExtResiduals;
+#endif
+#if defined(USE_WASM_SIMD)
+        if (dim % 16 == 0)
+            fstdistfunc_ = L2SqrSIMD16ExtWasm;
+        else if (dim % 4 == 0)
+            fstdistfunc_ = L2SqrSIMD4ExtWasm;
+        else if (dim > 16)
+            fstdistfunc_ = L2SqrSIMD16ExtWasmResiduals;
+        else if (dim > 4)
+            fstdistfunc_ = L2SqrSIMD4ExtWasmResiduals;
+#endif
+
+        batchdistfunc_ = L2SqrBatch;
+#if defined(USE_SSE)
+        if (dim >= 4)
+            batchdistfunc_ = L2SqrBatchSSE;
+#endif
+#if defined(USE_AVX)
+        if (dim >= 8 && AVXCapable())
+            batchdistfunc_ = L2SqrBatchAVX;
+#endif
+#if defined(USE_WASM_SIMD)
+        if (dim >= 4)
+            batchdistfunc_ = L2SqrBatchWasm;
 #endif
         dim_ = dim;
         data_size_ = dim * sizeof(float);
@@ -245,6 +532,10 @@ class L2Space : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    BATCHDISTFUNC<float> get_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
@@ -0,0 +1,291 @@
+#pragma once
+#include "hnswlib.h"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+namespace hnswlib {
+
+// Product quantization, the vector is split into M subvectors of dim / M values and every subvector
+// is stored as the byte index of its nearest centroid in a per subspace codebook of (up to) 256 centroids
+// trained with k-means.  An element takes M bytes instead of 4 * dim.
+//
+// Elements are compared through their centroids (symmetric distance, used while building the graph).
+// A query is not encoded: it is turned into an M x 256 table of query subvector to centroid distances,
+// so the query to element distance is M table lookups (asymmetric distance computation, ADC).
+
+static const size_t PQ_NUM_CENTROIDS = 256;
+
+struct PQDistParams {
+    /// number of subvectors, also the code size in bytes
+    size_t M;
+    size_t subDim;
+    /// M * 256 * subDim floats
+    const float *centroids;
+};
+
+static float
+PQSymmetricL2Sqr(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const PQDistParams *param = (const PQDistParams *) param_ptr;
+    const uint8_t *a = (const uint8_t *) pVect1;
+    const uint8_t *b = (const uint8_t *) pVect2;
+    const size_t subDim = param->subDim;
+
+    float res = 0;
+    for (size_t m = 0; m < param->M; m++) {
+        if (a[m] == b[m]) continue;
+        const float *ca = param->centroids + (m * PQ_NUM_CENTROIDS + a[m]) * subDim;
+        const float *cb = param->centroids + (m * PQ_NUM_CENTROIDS + b[m]) * subDim;
+        for (size_t i = 0; i < subDim; i++) {
+            float t = ca[i] - cb[i];
+            res += t * t;
+        }
+    }
+    return res;
+}
+
+static float
+PQSymmetricInnerProductDistance(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const PQDistParams *param = (const PQDistParams *) param_ptr;
+    const uint8_t *a = (const uint8_t *) pVect1;
+    const uint8_t *b = (const uint8_t *) pVect2;
+    const size_t subDim = param->subDim;
+
+    float res = 0;
+    for (size_t m = 0; m < param->M; m++) {
+        const float *ca = param->centroids + (m * PQ_NUM_CENTROIDS + a[m]) * subDim;
+        const float *cb = param->centroids + (m * PQ_NUM_CENTROIDS + b[m]) * subDim;
+        for (size_t i = 0; i < subDim; i++) {
+            res += ca[i] * cb[i];
+        }
+    }
+    return 1.0f - res;
+}
+
+// pVect1 is the query table of PQSpace::computeQueryTable, pVect2 an encoded element
+static float
+PQTableSum(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const PQDistParams *param = (const PQDistParams *) param_ptr;
+    const float *table = (const float *) pVect1;
+    const uint8_t *code = (const uint8_t *) pVect2;
+    const size_t M = param->M;
+    const size_t M4 = M >> 2 << 2;
+
+    // four independent sums, the lookups do not wait on each other
+    float res0 = 0, res1 = 0, res2 = 0, res3 = 0;
+    size_t m = 0;
+    for (; m < M4; m += 4) {
+        res0 += table[m * PQ_NUM_CENTROIDS + code[m]];
+        res1 += table[(m + 1) * PQ_NUM_CENTROIDS + code[m + 1]];
+        res2 += table[(m + 2) * PQ_NUM_CENTROIDS + code[m + 2]];
+        res3 += table[(m + 3) * PQ_NUM_CENTROIDS + code[m + 3]];
+    }
+    for (; m < M; m++) {
+        res0 += table[m * PQ_NUM_CENTROIDS + code[m]];
+    }
+    return (res0 + res1) + (res2 + res3);
+}
+
+static float
+PQTableL2Sqr(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    return PQTableSum(pVect1, pVect2, param_ptr);
+}
+
+static float
+PQTableInnerProductDistance(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    return 1.0f - PQTableSum(pVect1, pVect2, param_ptr);
+}
+
+class PQSpace : public SpaceInterface<float> {
+    size_t dim_;
+    bool innerProduct_;
+    size_t numCentroids_;
+    std::vector<float> centroids_;
+    PQDistParams param_;
+
+    static float subL2Sqr(const float *a, const float *b, size_t qty) {
+        float res = 0;
+        for (size_t i = 0; i < qty; i++) {
+            float t = a[i] - b[i];
+            res += t * t;
+        }
+        return res;
+    }
+
+    const float *centroid(size_t m, size_t c) const {
+        return centroids_.data() + (m * PQ_NUM_CENTROIDS + c) * param_.subDim;
+    }
+
+    uint8_t nearestCentroid(size_t m, const float *sub) const {
+        size_t best = 0;
+        float bestDist = std::numeric_limits<float>::max();
+        for (size_t c = 0; c < numCentroids_; c++) {
+            float dist = subL2Sqr(sub, centroid(m, c), param_.subDim);
+            if (dist < bestDist) {
+                bestDist = dist;
+                best = c;
+            }
+        }
+        return static_cast<uint8_t>(best);
+    }
+
+    void setLayout(size_t M) {
+        param_.M = M;
+        param_.subDim = M == 0 ? 0 : dim_ / M;
+        centroids_.assign(M * PQ_NUM_CENTROIDS * param_.subDim, 0.0f);
+        param_.centroids = centroids_.data();
+    }
+
+ public:
+    PQSpace(size_t dim, bool innerProduct) : dim_(dim), innerProduct_(innerProduct), numCentroids_(0) {
+        setLayout(0);
+    }
+
+    /// M bytes, zero until the codebooks are trained
+    size_t get_data_size() {
+        return param_.M;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return innerProduct_ ? PQSymmetricInnerProductDistance : PQSymmetricL2Sqr;
+    }
+
+    DISTFUNC<float> get_query_dist_func() {
+        return innerProduct_ ? PQTableInnerProductDistance : PQTableL2Sqr;
+    }
+
+    void *get_dist_func_param() {
+        return &param_;
+    }
+
+    size_t getDim() const {
+        return dim_;
+    }
+
+    size_t getNumSubvectors() const {
+        return param_.M;
+    }
+
+    bool isTrained() const {
+        return numCentroids_ > 0;
+    }
+
+    /// Floats of a query table, see computeQueryTable
+    size_t getQueryTableSize() const {
+        return param_.M * PQ_NUM_CENTROIDS;
+    }
+
+    /// Trains M codebooks with k-means on n row major vectors, dim must be divisible by M.
+    /// Fewer than 256 vectors train one centroid per vector.
+    void train(const float *data, size_t n, size_t M, size_t iterations, unsigned int seed = 100) {
+        if (n == 0) throw std::runtime_error("PQ training needs at least one vector");
+        if (M == 0 || dim_ % M != 0) throw std::runtime_error("PQ number of subvectors must divide the dimension");
+
+        setLayout(M);
+        numCentroids_ = std::min(n, PQ_NUM_CENTROIDS);
+        const size_t subDim = param_.subDim;
+        std::mt19937 rng(seed);
+        std::vector<size_t> order(n);
+        std::vector<uint8_t> assignment(n);
+        std::vector<float> sums(numCentroids_ * subDim);
+        std::vector<size_t> counts(numCentroids_);
+
+        for (size_t m = 0; m < M; m++) {
+            float *codebook = centroids_.data() + m * PQ_NUM_CENTROIDS * subDim;
+
+            // distinct random samples as initial centroids
+            std::iota(order.begin(), order.end(), 0);
+            std::shuffle(order.begin(), order.end(), rng);
+            for (size_t c = 0; c < numCentroids_; c++) {
+                memcpy(codebook + c * subDim, data + order[c] * dim_ + m * subDim, subDim * sizeof(float));
+            }
+
+            for (size_t iteration = 0; iteration < iterations; iteration++) {
+                std::fill(sums.begin(), sums.end(), 0.0f);
+                std::fill(counts.begin(), counts.end(), 0);
+                for (size_t row = 0; row < n; row++) {
+                    const float *sub = data + row * dim_ + m * subDim;
+                    uint8_t c = nearestCentroid(m, sub);
+                    assignment[row] = c;
+                    counts[c]++;
+                    for (size_t i = 0; i < subDim; i++) sums[c * subDim + i] += sub[i];
+                }
+                for (size_t c = 0; c < numCentroids_; c++) {
+                    if (counts[c] == 0) {
+                        // empty cluster, restart it from a random sample
+                        size_t row = std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+                        memcpy(codebook + c * subDim, data + row * dim_ + m * subDim, subDim * sizeof(float));
+                        continue;
+                    }
+                    for (size_t i = 0; i < subDim; i++) {
+                        codebook[c * subDim + i] = sums[c * subDim + i] / static_cast<float>(counts[c]);
+                    }
+                }
+            }
+        }
+    }
+
+    void encode(const float *vec, void *code) const {
+        uint8_t *out = (uint8_t *) code;
+        for (size_t m = 0; m < param_.M; m++) {
+            out[m] = nearestCentroid(m, vec + m * param_.subDim);
+        }
+    }
+
+    void decode(const void *code, float *vec) const {
+        const uint8_t *in = (const uint8_t *) code;
+        for (size_t m = 0; m < param_.M; m++) {
+            memcpy(vec + m * param_.subDim, centroid(m, in[m]), param_.subDim * sizeof(float));
+        }
+    }
+
+    /// Fills the getQueryTableSize() floats of table with the query subvector to centroid distances
+    /// (squared L2, or the dot product for inner product).  The table is then passed as the query.
+    void computeQueryTable(const float *query, float *table) const {
+        const size_t subDim = param_.subDim;
+        for (size_t m = 0; m < param_.M; m++) {
+            const float *sub = query + m * subDim;
+            float *row = table + m * PQ_NUM_CENTROIDS;
+            for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++) {
+                const float *cent = centroid(m, c);
+                if (innerProduct_) {
+                    float res = 0;
+                    for (size_t i = 0; i < subDim; i++) res += sub[i] * cent[i];
+                    row[c] = res;
+                } else {
+                    row[c] = subL2Sqr(sub, cent, subDim);
+                }
+            }
+        }
+    }
+
+    void saveParams(std::ostream &output) const {
+        writeBinaryPOD(output, dim_);
+        writeBinaryPOD(output, innerProduct_);
+        writeBinaryPOD(output, param_.M);
+        writeBinaryPOD(output, numCentroids_);
+        output.write((const char *) centroids_.data(), centroids_.size() * sizeof(float));
+    }
+
+    void loadParams(std::istream &input) {
+        size_t dim, M, numCentroids;
+        bool innerProduct;
+        readBinaryPOD(input, dim);
+        readBinaryPOD(input, innerProduct);
+        readBinaryPOD(input, M);
+        readBinaryPOD(input, numCentroids);
+        if (dim != dim_ || innerProduct != innerProduct_ || M == 0 || dim % M != 0 || numCentroids == 0 || numCentroids > PQ_NUM_CENTROIDS) {
+            throw std::runtime_error("PQ parameters do not match the space");
+        }
+        setLayout(M);
+        input.read((char *) centroids_.data(), centroids_.size() * sizeof(float));
+        if (!input) throw std::runtime_error("PQ parameters are truncated");
+        numCentroids_ = numCentroids;
+    }
+
+    ~PQSpace() {}
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,347 @@
+#pragma once
+#include "hnswlib.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace hnswlib {
+
+// 8 bit scalar quantization, every value x of dimension d is stored as the code
+// c = round((x - offset[d]) / scale[d]) in [0, 255] and decoded as offset[d] + scale[d] * c.
+// The range is trained from a sample, either one min/max for all dimensions (global) or one per dimension.
+//
+// Encoded layout: dim codes, for inner product padded to 4 bytes and followed by the float
+// sum(offset[d] * scale[d] * c[d]), so that x.y = sum(offset^2) + aux(x) + aux(y) + sum(scale^2 * cx * cy).
+
+struct SQ8DistParams {
+    size_t dim;
+    bool perDimension;
+    /// scale^2 of the global range
+    float scaleSq;
+    /// sum(offset[d]^2), only used for inner product
+    float constant;
+    /// scale[d]^2 per dimension
+    const float *weights;
+    /// byte offset of the inner product aux float
+    size_t auxOffset;
+};
+
+static uint32_t
+SQ8L2SqrCodes(const uint8_t *a, const uint8_t *b, size_t qty) {
+    uint32_t res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        int32_t t = static_cast<int32_t>(a[i]) - static_cast<int32_t>(b[i]);
+        res += static_cast<uint32_t>(t * t);
+    }
+    return res;
+}
+
+static uint32_t
+SQ8DotCodes(const uint8_t *a, const uint8_t *b, size_t qty) {
+    uint32_t res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        res += static_cast<uint32_t>(a[i]) * static_cast<uint32_t>(b[i]);
+    }
+    return res;
+}
+
+#if defined(USE_WASM_SIMD)
+
+// codes are widened to 16 bit lanes, i32x4_dot_i16x8 multiplies and adds pairs into 32 bit lanes
+static uint32_t
+SQ8L2SqrCodesWasm(const uint8_t *a, const uint8_t *b, size_t qty) {
+    size_t qty16 = qty >> 4 << 4;
+    v128_t sum = wasm_i32x4_splat(0);
+
+    for (size_t i = 0; i < qty16; i += 16) {
+        v128_t d = wasm_i16x8_sub(wasm_u16x8_load8x8(a + i), wasm_u16x8_load8x8(b + i));
+        sum = wasm_i32x4_add(sum, wasm_i32x4_dot_i16x8(d, d));
+        d = wasm_i16x8_sub(wasm_u16x8_load8x8(a + i + 8), wasm_u16x8_load8x8(b + i + 8));
+        sum = wasm_i32x4_add(sum, wasm_i32x4_dot_i16x8(d, d));
+    }
+
+    uint32_t res = static_cast<uint32_t>(wasm_i32x4_extract_lane(sum, 0)) + static_cast<uint32_t>(wasm_i32x4_extract_lane(sum, 1)) +
+        static_cast<uint32_t>(wasm_i32x4_extract_lane(sum, 2)) + static_cast<uint32_t>(wasm_i32x4_extract_lane(sum, 3));
+    return res + SQ8L2SqrCodes(a + qty16, b + qty16, qty - qty16);
+}
+
+static uint32_t
+SQ8DotCodesWasm(const uint8_t *a, const uint8_t *b, size_t qty) {
+    size_t qty16 = qty >> 4 << 4;
+    v128_t sum = wasm_i32x4_splat(0);
+
+    for (size_t i = 0; i < qty16; i += 16) {
+        sum = wasm_i32x4_add(sum, wasm_i32x4_dot_i16x8(wasm_u16x8_load8x8(a + i), wasm_u16x8_load8x8(b + i)));
+        sum = wasm_i32x4_add(sum, wasm_i32x4_dot_i16x8(wasm_u16x8_load8x8(a + i + 8), wasm_u16x8_load8x8(b + i + 8)));
+    }
+
+    uint32_t res = static_cast<uint32_t>(wasm_i32x4_extract_lane(sum, 0)) + static_cast<uint32_t>(wasm_i32x4_extract_lane(sum, 1)) +
+        static_cast<uint32_t>(wasm_i32x4_extract_lane(sum, 2)) + static_cast<uint32_t>(wasm_i32x4_extract_lane(sum, 3));
+    return res + SQ8DotCodes(a + qty16, b + qty16, qty - qty16);
+}
+
+#endif
+
+#if defined(USE_SSE) && (defined(__SSE2__) || defined(_M_AMD64) || defined(_M_X64))
+#define USE_SSE2_SQ8
+
+// same scheme with SSE2, codes are unpacked to 16 bit lanes and _mm_madd_epi16 adds pairs into 32 bit lanes
+static uint32_t
+SQ8L2SqrCodesSSE(const uint8_t *a, const uint8_t *b, size_t qty) {
+    int32_t PORTABLE_ALIGN32 TmpRes[4];
+    size_t qty16 = qty >> 4 << 4;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_setzero_si128();
+
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+        __m128i d = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(d, d));
+        d = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(d, d));
+    }
+
+    _mm_store_si128((__m128i *) TmpRes, sum);
+    uint32_t res = static_cast<uint32_t>(TmpRes[0]) + static_cast<uint32_t>(TmpRes[1]) + static_cast<uint32_t>(TmpRes[2]) + static_cast<uint32_t>(TmpRes[3]);
+    return res + SQ8L2SqrCodes(a + qty16, b + qty16, qty - qty16);
+}
+
+static uint32_t
+SQ8DotCodesSSE(const uint8_t *a, const uint8_t *b, size_t qty) {
+    int32_t PORTABLE_ALIGN32 TmpRes[4];
+    size_t qty16 = qty >> 4 << 4;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_setzero_si128();
+
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero)));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero)));
+    }
+
+    _mm_store_si128((__m128i *) TmpRes, sum);
+    uint32_t res = static_cast<uint32_t>(TmpRes[0]) + static_cast<uint32_t>(TmpRes[1]) + static_cast<uint32_t>(TmpRes[2]) + static_cast<uint32_t>(TmpRes[3]);
+    return res + SQ8DotCodes(a + qty16, b + qty16, qty - qty16);
+}
+
+#endif
+
+static uint32_t
+SQ8L2SqrCodesSIMD(const uint8_t *a, const uint8_t *b, size_t qty) {
+#if defined(USE_WASM_SIMD)
+    return SQ8L2SqrCodesWasm(a, b, qty);
+#elif defined(USE_SSE2_SQ8)
+    return SQ8L2SqrCodesSSE(a, b, qty);
+#else
+    return SQ8L2SqrCodes(a, b, qty);
+#endif
+}
+
+static uint32_t
+SQ8DotCodesSIMD(const uint8_t *a, const uint8_t *b, size_t qty) {
+#if defined(USE_WASM_SIMD)
+    return SQ8DotCodesWasm(a, b, qty);
+#elif defined(USE_SSE2_SQ8)
+    return SQ8DotCodesSSE(a, b, qty);
+#else
+    return SQ8DotCodes(a, b, qty);
+#endif
+}
+
+static float
+SQ8L2Sqr(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const SQ8DistParams *param = (const SQ8DistParams *) param_ptr;
+    const uint8_t *a = (const uint8_t *) pVect1;
+    const uint8_t *b = (const uint8_t *) pVect2;
+
+    if (!param->perDimension) {
+        return param->scaleSq * static_cast<float>(SQ8L2SqrCodesSIMD(a, b, param->dim));
+    }
+
+    float res = 0;
+    for (size_t i = 0; i < param->dim; i++) {
+        float t = static_cast<float>(static_cast<int32_t>(a[i]) - static_cast<int32_t>(b[i]));
+        res += param->weights[i] * t * t;
+    }
+    return res;
+}
+
+static float
+SQ8InnerProductDistance(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const SQ8DistParams *param = (const SQ8DistParams *) param_ptr;
+    const uint8_t *a = (const uint8_t *) pVect1;
+    const uint8_t *b = (const uint8_t *) pVect2;
+    float auxA, auxB;
+    memcpy(&auxA, a + param->auxOffset, sizeof(float));
+    memcpy(&auxB, b + param->auxOffset, sizeof(float));
+
+    float dot = 0;
+    if (!param->perDimension) {
+        dot = param->scaleSq * static_cast<float>(SQ8DotCodesSIMD(a, b, param->dim));
+    } else {
+        for (size_t i = 0; i < param->dim; i++) {
+            dot += param->weights[i] * static_cast<float>(a[i]) * static_cast<float>(b[i]);
+        }
+    }
+    return 1.0f - (param->constant + auxA + auxB + dot);
+}
+
+class SQ8Space : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    size_t data_size_;
+    size_t dim_;
+    bool innerProduct_;
+    bool trained_;
+    std::vector<float> offset_;
+    std::vector<float> scale_;
+    std::vector<float> weights_;
+    SQ8DistParams param_;
+
+    void updateParams(bool perDimension) {
+        weights_.resize(dim_);
+        float constant = 0;
+        for (size_t i = 0; i < dim_; i++) {
+            weights_[i] = scale_[i] * scale_[i];
+            constant += offset_[i] * offset_[i];
+        }
+        param_.perDimension = perDimension;
+        param_.scaleSq = weights_.empty() ? 0 : weights_[0];
+        param_.constant = constant;
+        param_.weights = weights_.data();
+        trained_ = true;
+    }
+
+ public:
+    SQ8Space(size_t dim, bool innerProduct) : dim_(dim), innerProduct_(innerProduct), trained_(false) {
+        fstdistfunc_ = innerProduct ? SQ8InnerProductDistance : SQ8L2Sqr;
+        const size_t auxOffset = (dim + 3) / 4 * 4;
+        data_size_ = innerProduct ? auxOffset + sizeof(float) : dim;
+        offset_.assign(dim, 0.0f);
+        scale_.assign(dim, 0.0f);
+        param_.dim = dim;
+        param_.auxOffset = auxOffset;
+        updateParams(false);
+        trained_ = false;
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &param_;
+    }
+
+    size_t getDim() const {
+        return dim_;
+    }
+
+    bool isTrained() const {
+        return trained_;
+    }
+
+    bool isPerDimension() const {
+        return param_.perDimension;
+    }
+
+    /// Trains the ranges on n row major vectors, one range for all dimensions or one per dimension
+    void train(const float *data, size_t n, bool perDimension) {
+        if (n == 0) throw std::runtime_error("SQ8 training needs at least one vector");
+
+        std::vector<float> minValues(dim_, std::numeric_limits<float>::max());
+        std::vector<float> maxValues(dim_, std::numeric_limits<float>::lowest());
+        for (size_t row = 0; row < n; row++) {
+            const float *vec = data + row * dim_;
+            for (size_t i = 0; i < dim_; i++) {
+                minValues[i] = std::min(minValues[i], vec[i]);
+                maxValues[i] = std::max(maxValues[i], vec[i]);
+            }
+        }
+
+        if (!perDimension) {
+            const float minValue = *std::min_element(minValues.begin(), minValues.end());
+            const float maxValue = *std::max_element(maxValues.begin(), maxValues.end());
+            std::fill(minValues.begin(), minValues.end(), minValue);
+            std::fill(maxValues.begin(), maxValues.end(), maxValue);
+        }
+
+        for (size_t i = 0; i < dim_; i++) {
+            offset_[i] = minValues[i];
+            scale_[i] = (maxValues[i] - minValues[i]) / 255.0f;
+        }
+        updateParams(perDimension);
+    }
+
+    void encode(const float *vec, void *code) const {
+        uint8_t *out = (uint8_t *) code;
+        float aux = 0;
+        for (size_t i = 0; i < dim_; i++) {
+            float c = scale_[i] > 0 ? std::round((vec[i] - offset_[i]) / scale_[i]) : 0.0f;
+            c = std::min(255.0f, std::max(0.0f, c));
+            out[i] = static_cast<uint8_t>(c);
+            aux += offset_[i] * scale_[i] * c;
+        }
+        if (innerProduct_) {
+            memset(out + dim_, 0, param_.auxOffset - dim_);
+            memcpy(out + param_.auxOffset, &aux, sizeof(float));
+        }
+    }
+
+    void decode(const void *code, float *vec) const {
+        const uint8_t *in = (const uint8_t *) code;
+        for (size_t i = 0; i < dim_; i++) {
+            vec[i] = offset_[i] + scale_[i] * static_cast<float>(in[i]);
+        }
+    }
+
+    /// Distance between a float query and an encoded vector, without the quantization error of the query
+    float asymmetricDistance(const float *query, const void *code) const {
+        const uint8_t *in = (const uint8_t *) code;
+        float res = 0;
+        if (innerProduct_) {
+            for (size_t i = 0; i < dim_; i++) {
+                res += query[i] * (offset_[i] + scale_[i] * static_cast<float>(in[i]));
+            }
+            return 1.0f - res;
+        }
+        for (size_t i = 0; i < dim_; i++) {
+            float t = query[i] - (offset_[i] + scale_[i] * static_cast<float>(in[i]));
+            res += t * t;
+        }
+        return res;
+    }
+
+    void saveParams(std::ostream &output) const {
+        writeBinaryPOD(output, dim_);
+        writeBinaryPOD(output, innerProduct_);
+        writeBinaryPOD(output, param_.perDimension);
+        output.write((const char *) offset_.data(), dim_ * sizeof(float));
+        output.write((const char *) scale_.data(), dim_ * sizeof(float));
+    }
+
+    void loadParams(std::istream &input) {
+        size_t dim;
+        bool innerProduct, perDimension;
+        readBinaryPOD(input, dim);
+        readBinaryPOD(input, innerProduct);
+        readBinaryPOD(input, perDimension);
+        if (dim != dim_ || innerProduct != innerProduct_) {
+            throw std::runtime_error("SQ8 parameters do not match the space");
+        }
+        input.read((char *) offset_.data(), dim_ * sizeof(float));
+        input.read((char *) scale_.data(), dim_ * sizeof(float));
+        if (!input) throw std::runtime_error("SQ8 parameters are truncated");
+        updateParams(perDimension);
+    }
+
+    ~SQ8Space() {}
+};
+
+}  // namespace hnswlib
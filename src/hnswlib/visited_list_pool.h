@@ -1,12 +1,25 @@
 #pragma once
 
+#include "hnswlib.h"
+#include <atomic>
 #include <mutex>
 #include <string.h>
 #include <deque>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
 
 namespace hnswlib {
 typedef unsigned short int vl_type;
 
+// Visited set of a search.  VISITED_AUTO lets VisitedListPool::chooseVisitedSet pick by index size and ef
+enum VisitedSetKind {
+    VISITED_AUTO,
+    VISITED_EPOCH,   // VisitedList: 2 bytes per element, reset by bumping the tag
+    VISITED_BITSET,  // VisitedBitset: 1 bit per element, reset clears the words the last search touched
+    VISITED_HASH,    // VisitedHashSet: open addressing on the visited ids, sized by ef
+};
+
 class VisitedList {
  public:
     vl_type curV;
@@ -27,52 +40,236 @@ class VisitedList {
         }
     }
 
+    void reset(size_t /*expected_visits*/) {
+        reset();
+    }
+
+    /// Marks id visited, returns false if it already was
+    bool visit(unsigned int id) {
+        if (mass[id] == curV) return false;
+        mass[id] = curV;
+        return true;
+    }
+
+    void prefetch(unsigned int id) const {
+#ifdef USE_SSE
+        _mm_prefetch((char *) (mass + id), _MM_HINT_T0);
+#else
+        (void) id;
+#endif
+    }
+
     ~VisitedList() { delete[] mass; }
 };
+
+
+class VisitedBitset {
+    std::vector<uint64_t> words_;
+    std::vector<unsigned int> touched_;  // words set since the last reset
+
+ public:
+    VisitedBitset(int numelements) : words_((numelements + 63) / 64, 0) {}
+
+    void reset(size_t /*expected_visits*/) {
+        if (touched_.size() * 8 > words_.size()) {
+            std::fill(words_.begin(), words_.end(), 0);
+        } else {
+            for (unsigned int word : touched_) words_[word] = 0;
+        }
+        touched_.clear();
+    }
+
+    bool visit(unsigned int id) {
+        uint64_t &word = words_[id / 64];
+        uint64_t bit = uint64_t(1) << (id % 64);
+        if (word & bit) return false;
+        if (word == 0) touched_.push_back(id / 64);
+        word |= bit;
+        return true;
+    }
+
+    void prefetch(unsigned int id) const {
+#ifdef USE_SSE
+        _mm_prefetch((char *) (words_.data() + id / 64), _MM_HINT_T0);
+#else
+        (void) id;
+#endif
+    }
+};
+
+
+class VisitedHashSet {
+    static constexpr unsigned int EMPTY = 0xFFFFFFFFu;
+    static constexpr size_t MIN_CAPACITY = 64;
+
+    std::vector<unsigned int> slots_;
+    size_t size_{0};
+    size_t mask_{0};
+    unsigned int shift_{32};
+
+    size_t home(unsigned int id) const {
+        return static_cast<uint32_t>(id * 2654435769u) >> shift_;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<unsigned int> slots(capacity, EMPTY);
+        slots.swap(slots_);
+        mask_ = capacity - 1;
+        shift_ = 32;
+        for (size_t c = capacity; c > 1; c >>= 1) shift_--;
+        size_ = 0;
+        for (unsigned int id : slots) {
+            if (id != EMPTY) visit(id);
+        }
+    }
+
+ public:
+    VisitedHashSet(int /*numelements*/) {}
+
+    /// Sizes the table for expected_visits ids at half load, it still grows if the search visits more.
+    /// The table never shrinks, a set that grew in one search is cleared in place for the next ones
+    void reset(size_t expected_visits) {
+        size_t capacity = MIN_CAPACITY;
+        while (capacity < 2 * expected_visits) capacity *= 2;
+        if (capacity > slots_.size()) {
+            slots_.clear();
+            rehash(capacity);
+        } else {
+            std::fill(slots_.begin(), slots_.end(), EMPTY);
+            size_ = 0;
+        }
+    }
+
+    /// Slots of the table, a power of two
+    size_t capacity() const {
+        return slots_.size();
+    }
+
+    bool visit(unsigned int id) {
+        if ((size_ + 1) * 2 > slots_.size()) rehash(slots_.size() * 2);
+        size_t slot = home(id);
+        for (; slots_[slot] != EMPTY; slot = (slot + 1) & mask_) {
+            if (slots_[slot] == id) return false;
+        }
+        slots_[slot] = id;
+        size_++;
+        return true;
+    }
+
+    void prefetch(unsigned int /*id*/) const {}
+};
+
 ///////////////////////////////////////////////////////////
 //
-// Class for multi-threaded pool-management of VisitedLists
+// Class for multi-threaded pool-management of VisitedLists.
+// Every thread has a slot per kind of set holding the set it released last, a search takes it
+// back with one atomic exchange.  The mutex guarded free lists are only used when the slot is
+// empty (first search of a thread, nested searches, threads sharing a slot).
 //
 /////////////////////////////////////////////////////////
 
 class VisitedListPool {
+    static constexpr size_t THREAD_SLOTS = 64;
+
     std::deque<VisitedList *> pool;
+    std::deque<VisitedBitset *> bitset_pool;
+    std::deque<VisitedHashSet *> hash_pool;
+    std::atomic<VisitedList *> list_slots_[THREAD_SLOTS];
+    std::atomic<VisitedBitset *> bitset_slots_[THREAD_SLOTS];
+    std::atomic<VisitedHashSet *> hash_slots_[THREAD_SLOTS];
     std::mutex poolguard;
     int numelements;
 
+    std::deque<VisitedList *> &freeSets(VisitedList *) { return pool; }
+    std::deque<VisitedBitset *> &freeSets(VisitedBitset *) { return bitset_pool; }
+    std::deque<VisitedHashSet *> &freeSets(VisitedHashSet *) { return hash_pool; }
+    std::atomic<VisitedList *> *threadSlots(VisitedList *) { return list_slots_; }
+    std::atomic<VisitedBitset *> *threadSlots(VisitedBitset *) { return bitset_slots_; }
+    std::atomic<VisitedHashSet *> *threadSlots(VisitedHashSet *) { return hash_slots_; }
+
+    /// Slot of the calling thread, threads are numbered in the order of their first search
+    static size_t threadSlot() {
+        static std::atomic<size_t> next_slot{0};
+        static thread_local size_t slot = next_slot++ % THREAD_SLOTS;
+        return slot;
+    }
+
+    template<typename Set>
+    void clearSets(std::deque<Set *> &sets, std::atomic<Set *> *slots) {
+        for (size_t i = 0; i < THREAD_SLOTS; i++) {
+            Set *rez = slots[i].exchange(nullptr);
+            if (rez != nullptr) sets.push_front(rez);
+        }
+        while (sets.size()) {
+            Set *rez = sets.front();
+            sets.pop_front();
+            delete rez;
+        }
+    }
+
  public:
+    // epoch arrays up to this many elements (128KB) are cheap enough, larger indexes use a bitset or a hash set
+    static constexpr size_t MAX_EPOCH_ELEMENTS = 1 << 16;
+    // above MAX_EPOCH_ELEMENTS a hash set is used while it is smaller than the bitset: 8 bytes per expected
+    // visit vs 1 bit per element
+    static constexpr size_t HASH_VISITS_PER_ELEMENT = 64;
+
     VisitedListPool(int initmaxpools, int numelements1) {
         numelements = numelements1;
+        for (size_t i = 0; i < THREAD_SLOTS; i++) {
+            list_slots_[i] = nullptr;
+            bitset_slots_[i] = nullptr;
+            hash_slots_[i] = nullptr;
+        }
         for (int i = 0; i < initmaxpools; i++)
             pool.push_front(new VisitedList(numelements));
     }
 
+    /// expected_visits: about ef times the level 0 degree
+    VisitedSetKind chooseVisitedSet(size_t expected_visits) const {
+        if (static_cast<size_t>(numelements) <= MAX_EPOCH_ELEMENTS) return VISITED_EPOCH;
+        if (expected_visits * HASH_VISITS_PER_ELEMENT <= static_cast<size_t>(numelements)) return VISITED_HASH;
+        return VISITED_BITSET;
+    }
+
     VisitedList *getFreeVisitedList() {
-        VisitedList *rez;
-        {
+        return getFreeVisitedSet<VisitedList>(0);
+    }
+
+    void releaseVisitedList(VisitedList *vl) {
+        releaseVisitedSet(vl);
+    }
+
+    template<typename Set>
+    Set *getFreeVisitedSet(size_t expected_visits) {
+        Set *rez = threadSlots((Set *) nullptr)[threadSlot()].exchange(nullptr, std::memory_order_acquire);
+        if (rez == nullptr) {
             std::unique_lock <std::mutex> lock(poolguard);
-            if (pool.size() > 0) {
-                rez = pool.front();
-                pool.pop_front();
+            std::deque<Set *> &sets = freeSets((Set *) nullptr);
+            if (sets.size() > 0) {
+                rez = sets.front();
+                sets.pop_front();
             } else {
-                rez = new VisitedList(numelements);
+                rez = new Set(numelements);
             }
         }
-        rez->reset();
+        rez->reset(expected_visits);
         return rez;
     }
 
-    void releaseVisitedList(VisitedList *vl) {
+    template<typename Set>
+    void releaseVisitedSet(Set *set) {
+        Set *empty = nullptr;
+        if (threadSlots(set)[threadSlot()].compare_exchange_strong(empty, set, std::memory_order_release))
+            return;
         std::unique_lock <std::mutex> lock(poolguard);
-        pool.push_front(vl);
+        freeSets(set).push_front(set);
     }
 
     ~VisitedListPool() {
-        while (pool.size()) {
-            VisitedList *rez = pool.front();
-            pool.pop_front();
-            delete rez;
-        }
+        clearSets(pool, list_slots_);
+        clearSets(bitset_pool, bitset_slots_);
+        clearSets(hash_pool, hash_slots_);
     }
 };
 }  // namespace hnswlib
@@ -6,7 +6,14 @@ export type HierarchicalNSW = module.HierarchicalNSW;
 export type BruteforceSearch = module.BruteforceSearch;
 export type EmscriptenFileSystemManager = module.EmscriptenFileSystemManager;
 export type L2Space = module.L2Space;
+export type HierarchicalNSWSpaceName = module.HierarchicalNSWSpaceName;
+export type BruteforceSearchSpaceName = module.BruteforceSearchSpaceName;
+export type ProductQuantizedSpaceName = module.ProductQuantizedSpaceName;
 export type InnerProductSpace = module.InnerProductSpace;
+export type LabelFilter = module.LabelFilter;
+export type LabelBitsetFilter = module.LabelBitsetFilter;
+export type LabelRangeFilter = module.LabelRangeFilter;
+export type LabelSetFilter = module.LabelSetFilter;
 
 export type HnswModuleFactory = typeof factory;
 export type normalizePoint = HnswlibModule['normalizePoint'];
@@ -14,13 +21,16 @@ export const IDBFS_STORE_NAME = 'FILE_DATA';
 
 export * from './constants';
 
-export interface HnswlibModule extends Omit<EmscriptenModule, '_malloc' | '_free'> {
+export interface HnswlibModule extends EmscriptenModule {
   normalizePoint(vec: number[]): number[];
   L2Space: typeof module.L2Space;
   InnerProductSpace: typeof module.InnerProductSpace;
   BruteforceSearch: typeof module.BruteforceSearch;
   HierarchicalNSW: typeof module.HierarchicalNSW;
   EmscriptenFileSystemManager: typeof module.EmscriptenFileSystemManager;
+  LabelBitsetFilter: typeof module.LabelBitsetFilter;
+  LabelRangeFilter: typeof module.LabelRangeFilter;
+  LabelSetFilter: typeof module.LabelSetFilter;
   asm: {
     malloc(size: number): number;
     free(ptr: number): void;
@@ -30,6 +40,43 @@ export interface HnswlibModule extends Omit<EmscriptenModule, '_malloc' | '_free
 let library: Awaited<HnswlibModule>;
 type InputFsType = 'IDBFS' | undefined;
 
+/**
+ * Which emcc build to load. `auto` picks `simd` when the runtime supports wasm simd128, otherwise `default`.
+ * `threads` is never picked automatically, it needs SharedArrayBuffer and a cross origin isolated page.
+ */
+export type HnswlibBuildVariant = 'auto' | 'default' | 'simd' | 'threads';
+
+// smallest module using a v128 instruction, WebAssembly.validate fails on runtimes without simd128
+const wasmSimdProbe = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11,
+]);
+
+/**
+ * Checks if the runtime supports WebAssembly simd128, which is required by the `simd` build.
+ */
+export const isWasmSimdSupported = (): boolean => {
+  try {
+    return typeof WebAssembly === 'object' && WebAssembly.validate(wasmSimdProbe);
+  } catch (err) {
+    return false;
+  }
+};
+
+/**
+ * Allocates `length` floats in the wasm heap, for the zero copy `*FromHeap` APIs of {@link HierarchicalNSW}.
+ * Write the vectors into `array` and pass `ptr` to e.g. `addItemsFromHeap`, then release it with `lib._free(ptr)`.
+ * The `array` view is detached when the wasm memory grows (e.g. while adding points), so fill it before calling into the index.
+ * @param lib The loaded module, see {@link loadHnswlib}.
+ * @param length The number of floats to allocate.
+ * @returns The byte offset of the allocation and a Float32Array view on it.
+ */
+export const allocateHeapFloat32Array = (lib: HnswlibModule, length: number): { ptr: number; array: Float32Array } => {
+  const ptr = lib._malloc(length * Float32Array.BYTES_PER_ELEMENT);
+  if (ptr === 0) throw new Error('Failed to allocate memory in the wasm heap.');
+  const start = ptr / Float32Array.BYTES_PER_ELEMENT;
+  return { ptr, array: lib.HEAPF32.subarray(start, start + length) };
+};
+
 export const syncFileSystem = (action: 'read' | 'write'): Promise<void> => {
   const EmscriptenFileSystemManager: HnswlibModule['EmscriptenFileSystemManager'] = library.EmscriptenFileSystemManager;
 
@@ -47,6 +94,19 @@ export const syncFileSystem = (action: 'read' | 'write'): Promise<void> => {
   });
 };
 
+/**
+ * Saves the changes a debounced auto save is holding back (see `HierarchicalNSW.setAutoSaveOptions`).
+ * @returns A promise that resolves once the auto save file is synced to IDBFS.
+ */
+export const flushAutoSave = (index: HierarchicalNSW): Promise<void> =>
+  new Promise((resolve, reject) => {
+    try {
+      index.flushAutoSave(() => resolve());
+    } catch (error) {
+      reject(error);
+    }
+  });
+
 export const waitForFileSystemInitalized = (): Promise<void> => {
   const EmscriptenFileSystemManager: HnswlibModule['EmscriptenFileSystemManager'] = library.EmscriptenFileSystemManager;
   return new Promise((resolve, reject) => {
@@ -108,10 +168,40 @@ const initializeFileSystemAsync = async (inputFsType?: InputFsType): Promise<voi
   return await waitForFileSystemInitalized();
 };
 
+/**
+ * Checks if the runtime can run the `threads` build, it needs SharedArrayBuffer which browsers only expose to cross origin isolated pages.
+ */
+export const isThreadsSupported = (): boolean => {
+  const isolated = (globalThis as { crossOriginIsolated?: boolean }).crossOriginIsolated;
+  return typeof SharedArrayBuffer !== 'undefined' && isolated !== false && isWasmSimdSupported();
+};
+
+const importModuleFactory = async (variant: Exclude<HnswlibBuildVariant, 'auto'>) => {
+  if (variant === 'threads') {
+    if (!isThreadsSupported()) throw new Error('The threads build needs SharedArrayBuffer and a cross origin isolated page');
+    // eslint-disable-next-line @typescript-eslint/ban-ts-comment
+    // @ts-ignore
+    return (await import('./hnswlib-threads.mjs')).default;
+  }
+  if (variant === 'simd') {
+    // eslint-disable-next-line @typescript-eslint/ban-ts-comment
+    // @ts-ignore
+    return (await import('./hnswlib-simd.mjs')).default;
+  }
+  // eslint-disable-next-line @typescript-eslint/ban-ts-comment
+  // @ts-ignore
+  return (await import('./hnswlib.mjs')).default;
+};
+
 /**
  * Load the HNSW library in node or browser
+ * @param inputFsType The type of file system to use. Can be 'IDBFS' or undefined.
+ * @param buildVariant The emcc build to load (default: 'auto'). The simd build uses simd128 distance kernels.
  */
-export const loadHnswlib = async (inputFsType?: InputFsType): Promise<HnswlibModule> => {
+export const loadHnswlib = async (
+  inputFsType?: InputFsType,
+  buildVariant: HnswlibBuildVariant = 'auto'
+): Promise<HnswlibModule> => {
   try {
     // @ts-expect-error - hnswlib can be a global variable in the browser
     if (typeof hnswlib !== 'undefined' && hnswlib !== null) {
@@ -121,10 +211,8 @@ export const loadHnswlib = async (inputFsType?: InputFsType): Promise<HnswlibMod
     }
 
     if (!library) {
-      // eslint-disable-next-line @typescript-eslint/ban-ts-comment
-      // @ts-ignore
-      const temp = await import('./hnswlib.mjs');
-      const factoryFunc = temp.default;
+      const variant = buildVariant === 'auto' ? (isWasmSimdSupported() ? 'simd' : 'default') : buildVariant;
+      const factoryFunc = await importModuleFactory(variant);
 
       library = await factoryFunc();
       await initializeFileSystemAsync(inputFsType);
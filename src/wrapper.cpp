@@ -3,6 +3,7 @@
 #endif
 
 #include <emscripten.h>
+#include <emscripten/eventloop.h>
 #include <emscripten/bind.h>
 #include <emscripten/val.h>
 #include <emscripten/em_asm.h>
@@ -20,6 +21,12 @@
 #include <future>
 #include <stdexcept>
 #include <stdio.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <limits>
+#include <unordered_set>
 
 
 
@@ -57,7 +64,9 @@ namespace emscripten {
   private:
     static std::mutex init_mutex_;
     static std::mutex sync_mutex_;
-    static std::unique_lock<std::mutex> sync_lock_;
+    static bool syncInFlight_;
+    /// @brief syncs requested while FS.syncfs was running, issued one after another from setIsSynced
+    static std::deque<std::pair<bool, emscripten::val>> pendingSyncs_;
     static emscripten::val syncCallback_;
     static bool initialized_;
     static bool synced_;
@@ -95,24 +104,50 @@ namespace emscripten {
         if (EmscriptenFileSystemManager::debugLogs) printf("EmscriptenFileSystemManager must be initialized before calling syncFS\n");
         throw std::runtime_error("EmscriptenFileSystemManager must be initialized before calling syncFS");
       }
-      sync_lock_ = std::unique_lock<std::mutex>(sync_mutex_);
-      syncCallback_ = callback;
-      synced_ = false;
+      {
+        // FS.syncfs completes on the event loop, so queue the request instead of blocking the main thread on it
+        std::lock_guard<std::mutex> lock(sync_mutex_);
+        if (syncInFlight_) {
+          if (EmscriptenFileSystemManager::debugLogs) printf("a. syncFS queued, a sync is already in flight\n");
+          pendingSyncs_.emplace_back(populateFromFS, callback);
+          return;
+        }
+        syncInFlight_ = true;
+        syncCallback_ = callback;
+        synced_ = false;
+      }
       syncIdb_js(populateFromFS);
     }
 
     static void setIsSynced(bool synced) {
 
       if (EmscriptenFileSystemManager::debugLogs) printf("c. IDBFS has synced\n");
-      synced_ = synced;
-      if (!syncCallback_.isUndefined()) {
-        printf("d. Calling sync callback...\n");
-        syncCallback_.call<void>("call", emscripten::val::undefined());
+      emscripten::val callback = emscripten::val::undefined();
+      bool hasPendingSync = false;
+      bool pendingPopulateFromFS = false;
+      {
+        std::lock_guard<std::mutex> lock(sync_mutex_);
+        synced_ = synced;
+        callback = syncCallback_;
         syncCallback_ = emscripten::val::undefined();
+        if (!pendingSyncs_.empty()) {
+          hasPendingSync = true;
+          pendingPopulateFromFS = pendingSyncs_.front().first;
+          syncCallback_ = pendingSyncs_.front().second;
+          pendingSyncs_.pop_front();
+          synced_ = false;
+        }
+        else {
+          syncInFlight_ = false;
+        }
       }
-      if (sync_lock_.owns_lock()) {
-        sync_lock_.unlock();
-        if (EmscriptenFileSystemManager::debugLogs) printf("e. IDBFS has synced\n");
+      if (!callback.isUndefined()) {
+        printf("d. Calling sync callback...\n");
+        callback.call<void>("call", emscripten::val::undefined());
+      }
+      if (hasPendingSync) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("e. starting queued syncFS\n");
+        syncIdb_js(pendingPopulateFromFS);
       }
     }
 
@@ -152,7 +187,8 @@ namespace emscripten {
 
   std::mutex EmscriptenFileSystemManager::init_mutex_;
   std::mutex EmscriptenFileSystemManager::sync_mutex_;
-  std::unique_lock<std::mutex> EmscriptenFileSystemManager::sync_lock_;
+  bool EmscriptenFileSystemManager::syncInFlight_ = false;
+  std::deque<std::pair<bool, emscripten::val>> EmscriptenFileSystemManager::pendingSyncs_;
   emscripten::val EmscriptenFileSystemManager::syncCallback_;
   bool EmscriptenFileSystemManager::initialized_ = false;
   bool EmscriptenFileSystemManager::debugLogs = false;
@@ -182,6 +218,13 @@ namespace emscripten {
       }
 
       static std::vector<T, Allocator> fromWireType(WireType value) {
+        if constexpr (std::is_arithmetic<T>::value) {
+          // typed arrays are copied into the vector in one bulk copy instead of element by element
+          const val& array = ValBinding::fromWireType(value);
+          if (array.instanceof(val::global("Float32Array"))) {
+            return convertJSArrayToNumberVector<T>(array);
+          }
+        }
         return vecFromJSArray<T>(ValBinding::fromWireType(value));
       }
     };
@@ -212,17 +255,191 @@ namespace emscripten {
       }
     }
 
+    /// @brief Number of worker threads to use for `requested` threads, 0 means one per core.  Always 1 when built without -pthread.
+    size_t resolveNumThreads(size_t requested) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+      // the pool is PTHREAD_POOL_SIZE=navigator.hardwareConcurrency, more threads than that can't start while the main thread blocks on join
+      const size_t maxThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+      return requested == 0 ? maxThreads : std::min(requested, maxThreads);
+#else
+      return 1;
+#endif
+    }
+
+    /// @brief ParallelFor starts a thread per MIN_ITEMS_PER_THREAD items at most, a thread start and join (about 20us natively,
+    /// more for a wasm worker) is then small next to the searches or inserts of the thread
+    constexpr size_t MIN_ITEMS_PER_THREAD = 4;
+
+    /// @brief Runs fn(id, threadId) for every id in [start, end) on up to numThreads threads, the same scheme as the hnswlib python bindings.
+    /// Small ranges run on the calling thread.  The first exception thrown by fn is rethrown on the calling thread.
+    template <class Function>
+    void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
+      numThreads = std::min(numThreads, (end - start) / MIN_ITEMS_PER_THREAD);
+      if (numThreads <= 1) {
+        for (size_t id = start; id < end; id++) {
+          fn(id, 0);
+        }
+        return;
+      }
+
+      std::vector<std::thread> threads;
+      std::atomic<size_t> current(start);
+      std::exception_ptr lastException = nullptr;
+      std::mutex lastExceptMutex;
+
+      for (size_t threadId = 0; threadId < numThreads; ++threadId) {
+        threads.push_back(std::thread([&, threadId] {
+          while (true) {
+            size_t id = current.fetch_add(1);
+            if (id >= end) {
+              break;
+            }
+
+            try {
+              fn(id, threadId);
+            }
+            catch (...) {
+              std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
+              lastException = std::current_exception();
+              current = end;
+              break;
+            }
+          }
+        }));
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      if (lastException) {
+        std::rethrow_exception(lastException);
+      }
+    }
+
     void normalizePointsPtrs(float* vec, size_t dim) {
       float sum = 0;
       for (size_t i = 0; i < dim; ++i) {
         sum += vec[i] * vec[i];
       }
       float norm = sqrt(sum);
-      for (size_t i = 0; i < dim; ++i) {
-        vec[i] /= norm;
+      if (norm > 0.0f) {
+        for (size_t i = 0; i < dim; ++i) {
+          vec[i] /= norm;
+        }
+      }
+    }
+
+    /// @brief Returns a pointer into the wasm heap from a byte offset, as returned by Module._malloc
+    template <typename T>
+    T* heapPointer(uintptr_t byteOffset) {
+      if (byteOffset == 0 || byteOffset % alignof(T) != 0) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Invalid heap pointer %lu, it must be a non null pointer aligned to %zu bytes.\n", static_cast<unsigned long>(byteOffset), alignof(T));
+        throw std::invalid_argument("Invalid heap pointer " + std::to_string(byteOffset) + ", it must be a non null pointer aligned to " + std::to_string(alignof(T)) + " bytes.");
       }
+      return reinterpret_cast<T*>(byteOffset);
     }
 
+    /// @brief Copies training samples into one row major buffer, normalized for the cosine spaces
+    std::vector<float> flattenSamples(const std::vector<std::vector<float>>& samples, uint32_t dim, bool normalize) {
+      if (samples.empty()) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The number of vectors must be greater than 0.\n");
+        throw std::invalid_argument("The number of vectors must be greater than 0.");
+      }
+
+      std::vector<float> flat(samples.size() * dim);
+      for (size_t i = 0; i < samples.size(); ++i) {
+        if (samples[i].size() != dim) {
+          if (EmscriptenFileSystemManager::debugLogs) printf("Invalid vector size at index %zu. Must be equal to the dimension of the space. The dimension of the space is %d.\n", i, dim);
+          throw std::invalid_argument("Invalid vector size at index " + std::to_string(i) + ". Must be equal to the dimension of the space. The dimension of the space is " + std::to_string(dim) + ".");
+        }
+        std::copy(samples[i].begin(), samples[i].end(), flat.begin() + i * dim);
+        if (normalize) {
+          normalizePointsPtrs(flat.data() + i * dim, dim);
+        }
+      }
+      return flat;
+    }
+
+    /// @brief Quantizer parameters are stored next to the index file, e.g. `<filename>.sq8` or `<filename>.pq`
+    template <typename Quantizer>
+    void writeQuantizerParams(const Quantizer& quantizer, const std::string& file) {
+      std::ofstream output(file, std::ios::binary);
+      if (!output.is_open()) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Cannot open file %s\n", file.c_str());
+        throw std::runtime_error("Cannot open file " + file);
+      }
+      quantizer.saveParams(output);
+    }
+
+    template <typename Quantizer>
+    void readQuantizerParams(Quantizer& quantizer, const std::string& file) {
+      std::ifstream input(file, std::ios::binary);
+      if (!input.is_open()) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Missing the quantizer parameters file %s\n", file.c_str());
+        throw std::runtime_error("Missing the quantizer parameters file " + file);
+      }
+      quantizer.loadParams(input);
+    }
+
+    /// @brief Hands out the labels of addItems: deleted labels first when they are to be replaced, then labels above the largest label ever added.
+    /// Updated by every add and delete mark, so a batch costs O(batch) instead of a walk over the label lookup.
+    /// Deleted labels are checked when handed out, a label revived by unmarkDelete or dropped by a replacement is skipped then.
+    class LabelAllocator {
+    public:
+      /// @brief Rebuilds the state from a loaded index, one pass over its labels
+      void reset(hnswlib::HierarchicalNSW<float>& index) {
+        next_ = 0;
+        deleted_.clear();
+        queued_.clear();
+        for (const auto& pair : index.label_lookup_) {
+          next_ = std::max<uint64_t>(next_, static_cast<uint64_t>(pair.first) + 1);
+        }
+        for (const hnswlib::labeltype label : index.getLabels(true)) {
+          addDeleted(static_cast<uint32_t>(label));
+        }
+      }
+
+      void addUsed(const uint32_t* labels, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+          next_ = std::max<uint64_t>(next_, static_cast<uint64_t>(labels[i]) + 1);
+        }
+      }
+
+      void addDeleted(uint32_t label) {
+        if (queued_.insert(label).second) deleted_.push_back(label);
+      }
+
+      std::vector<uint32_t> allocate(size_t count, bool replace_deleted, hnswlib::HierarchicalNSW<float>& index) {
+        std::vector<uint32_t> labels;
+        labels.reserve(count);
+
+        if (replace_deleted) {
+          std::lock_guard<std::mutex> guard(index.label_lookup_lock);
+          while (labels.size() < count && !deleted_.empty()) {
+            const uint32_t label = deleted_.back();
+            deleted_.pop_back();
+            queued_.erase(label);
+            auto found = index.label_lookup_.find(label);
+            if (found != index.label_lookup_.end() && index.isMarkedDeleted(found->second)) {
+              labels.push_back(label);
+            }
+          }
+        }
+
+        while (labels.size() < count) {
+          labels.push_back(static_cast<uint32_t>(next_++));
+        }
+        return labels;
+      }
+
+    private:
+      /// @brief One past the largest label ever added
+      uint64_t next_ = 0;
+      /// @brief Deleted labels, the most recently deleted is reused first
+      std::vector<uint32_t> deleted_;
+      /// @brief The labels in deleted_, so that a label deleted again is not queued twice
+      std::unordered_set<uint32_t> queued_;
+    };
+
 
   }  // namespace internal
 
@@ -322,6 +539,11 @@ namespace emscripten {
       }
     }
 
+    // a call into JS costs several distance computations, searchKnn samples a few labels only
+    float callCost() const override {
+      return 4.0f;
+    }
+
     // Explicitly declare the destructor with the same exception specification as the base class
     ~CustomFilterFunctor() noexcept = default;
 
@@ -329,6 +551,172 @@ namespace emscripten {
     emscripten::val callback_;
   };
 
+  /// @brief Base class of the native label filters.  They are built once in JS and evaluated in C++ for every candidate, without the JS call of CustomFilterFunctor.
+  /// An allow list accepts only the labels it contains, a deny list accepts every label except the ones it contains.
+  class LabelFilter : public hnswlib::BaseFilterFunctor {
+  public:
+    explicit LabelFilter(bool allowList) : allowList_(allowList) {}
+
+    bool operator()(hnswlib::labeltype id) override {
+      return contains(static_cast<uint32_t>(id)) == allowList_;
+    }
+
+    virtual bool contains(uint32_t label) const = 0;
+
+    bool isAllowed(uint32_t label) {
+      return (*this)(static_cast<hnswlib::labeltype>(label));
+    }
+
+    bool isAllowList() const {
+      return allowList_;
+    }
+
+    ~LabelFilter() noexcept = default;
+
+  private:
+    bool allowList_;
+  };
+
+  /// @brief Bitset over labels, one bit per label up to the largest label added.  Best for dense labels as generated by addItems.
+  class LabelBitsetFilter : public LabelFilter {
+  public:
+    LabelBitsetFilter(const std::vector<uint32_t>& labels, bool allowList) : LabelFilter(allowList) {
+      addLabels(labels);
+    }
+
+    bool contains(uint32_t label) const override {
+      const size_t word = label >> 6;
+      return word < bits_.size() && (bits_[word] >> (label & 63)) & 1;
+    }
+
+    void add(uint32_t label) {
+      const size_t word = label >> 6;
+      if (word >= bits_.size()) bits_.resize(word + 1, 0);
+      bits_[word] |= uint64_t(1) << (label & 63);
+    }
+
+    void addLabels(const std::vector<uint32_t>& labels) {
+      if (!labels.empty()) {
+        const uint32_t maxLabel = *std::max_element(labels.begin(), labels.end());
+        if ((maxLabel >> 6) >= bits_.size()) bits_.resize((maxLabel >> 6) + 1, 0);
+      }
+      for (uint32_t label : labels) add(label);
+    }
+
+    void remove(uint32_t label) {
+      const size_t word = label >> 6;
+      if (word < bits_.size()) bits_[word] &= ~(uint64_t(1) << (label & 63));
+    }
+
+    void clear() {
+      bits_.clear();
+    }
+
+  private:
+    std::vector<uint64_t> bits_;
+  };
+
+  /// @brief Sorted, merged label ranges [start, end), checked with a binary search.  Best for labels allocated in blocks, e.g. one block per tenant.
+  class LabelRangeFilter : public LabelFilter {
+  public:
+    explicit LabelRangeFilter(bool allowList) : LabelFilter(allowList) {}
+
+    bool contains(uint32_t label) const override {
+      // first range starting after label, the one before it is the only candidate
+      auto it = std::upper_bound(ranges_.begin(), ranges_.end(), label,
+        [](uint32_t value, const std::pair<uint32_t, uint32_t>& range) { return value < range.first; });
+      return it != ranges_.begin() && label < std::prev(it)->second;
+    }
+
+    void addRange(uint32_t start, uint32_t end) {
+      if (end <= start) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Invalid label range [%u, %u), end must be greater than start.\n", start, end);
+        throw std::invalid_argument("Invalid label range [" + std::to_string(start) + ", " + std::to_string(end) + "), end must be greater than start.");
+      }
+
+      auto it = std::lower_bound(ranges_.begin(), ranges_.end(), std::make_pair(start, end));
+      it = ranges_.insert(it, std::make_pair(start, end));
+      // merge with the previous range, then swallow the following ones
+      if (it != ranges_.begin() && std::prev(it)->second >= it->first) {
+        std::prev(it)->second = std::max(std::prev(it)->second, it->second);
+        it = std::prev(ranges_.erase(it));
+      }
+      auto next = std::next(it);
+      while (next != ranges_.end() && next->first <= it->second) {
+        it->second = std::max(it->second, next->second);
+        next = ranges_.erase(next);
+        it = std::prev(next);
+      }
+    }
+
+    void clear() {
+      ranges_.clear();
+    }
+
+    uint32_t getNumRanges() const {
+      return static_cast<uint32_t>(ranges_.size());
+    }
+
+  private:
+    std::vector<std::pair<uint32_t, uint32_t>> ranges_;
+  };
+
+  /// @brief Hashed label set.  Best for a small number of sparse labels.
+  class LabelSetFilter : public LabelFilter {
+  public:
+    LabelSetFilter(const std::vector<uint32_t>& labels, bool allowList) : LabelFilter(allowList), labels_(labels.begin(), labels.end()) {}
+
+    bool contains(uint32_t label) const override {
+      return labels_.count(label) != 0;
+    }
+
+    void add(uint32_t label) {
+      labels_.insert(label);
+    }
+
+    void addLabels(const std::vector<uint32_t>& labels) {
+      labels_.insert(labels.begin(), labels.end());
+    }
+
+    void remove(uint32_t label) {
+      labels_.erase(label);
+    }
+
+    void clear() {
+      labels_.clear();
+    }
+
+  private:
+    std::unordered_set<uint32_t> labels_;
+  };
+
+  /// @brief The filter argument of the search methods: undefined, a native LabelFilter or a JS function called for every candidate.
+  class SearchFilter {
+  public:
+    explicit SearchFilter(emscripten::val filter) {
+      if (filter.isNull() || filter.isUndefined()) return;
+      if (filter.typeOf().as<std::string>() == "object") {
+        nativeFilter_ = filter.as<LabelFilter*>(emscripten::allow_raw_pointers());
+      }
+      else {
+        jsFilter_ = std::make_unique<CustomFilterFunctor>(filter);
+      }
+    }
+
+    hnswlib::BaseFilterFunctor* get() const {
+      return nativeFilter_ != nullptr ? static_cast<hnswlib::BaseFilterFunctor*>(nativeFilter_) : jsFilter_.get();
+    }
+
+    /// @brief JS functions can only be called from the main thread
+    bool callsJs() const {
+      return jsFilter_ != nullptr;
+    }
+
+  private:
+    LabelFilter* nativeFilter_ = nullptr;
+    std::unique_ptr<CustomFilterFunctor> jsFilter_;
+  };
+
 
 
   /*****************/
@@ -339,6 +727,8 @@ namespace emscripten {
     hnswlib::BruteforceSearch<float>* index_;
     hnswlib::SpaceInterface<float>* space_;
     bool normalize_;
+    /// @brief Set for the pq spaces, points to space_.  Vectors are stored as product quantization codes and scanned with query tables
+    hnswlib::PQSpace* pqSpace_ = nullptr;
 
     BruteforceSearch(const std::string& space_name, uint32_t dim)
       : index_(nullptr), space_(nullptr), normalize_(false), dim_(dim) {
@@ -353,9 +743,14 @@ namespace emscripten {
         space_ = new hnswlib::InnerProductSpace(static_cast<size_t>(dim_));
         normalize_ = true;
       }
+      else if (space_name == "l2-pq" || space_name == "ip-pq" || space_name == "cosine-pq") {
+        pqSpace_ = new hnswlib::PQSpace(static_cast<size_t>(dim_), space_name != "l2-pq");
+        space_ = pqSpace_;
+        normalize_ = space_name == "cosine-pq";
+      }
       else {
-        if (EmscriptenFileSystemManager::debugLogs) printf("invalid space should be expected l2, ip, or cosine, name: %s\n", space_name.c_str());
-        throw std::invalid_argument("invalid space should be expected l2, ip, or cosine, name: " + space_name);
+        if (EmscriptenFileSystemManager::debugLogs) printf("invalid space should be expected l2, ip, or cosine (or l2-pq, ip-pq, cosine-pq), name: %s\n", space_name.c_str());
+        throw std::invalid_argument("invalid space should be expected l2, ip, or cosine (or l2-pq, ip-pq, cosine-pq), name: " + space_name);
       }
     }
 
@@ -374,12 +769,51 @@ namespace emscripten {
     }
 
     void initIndex(uint32_t max_elements) {
+      requireTrainedProductQuantizer();
       if (index_) delete index_;
       index_ = new hnswlib::BruteforceSearch<float>(space_, static_cast<size_t>(max_elements));
     }
 
+    /// @brief Trains the product quantizer of the pq spaces on sample vectors, it must be called before `initIndex`.
+    /// @param samples vectors representative of the data, the codebooks are trained with k-means on them
+    /// @param numSubvectors bytes per stored vector, the dimension must be divisible by it
+    /// @param iterations k-means iterations
+    void trainProductQuantizer(const std::vector<std::vector<float>>& samples, uint32_t numSubvectors, uint32_t iterations) {
+      if (pqSpace_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("trainProductQuantizer is only available for the pq spaces (l2-pq, ip-pq, cosine-pq).\n");
+        throw std::invalid_argument("trainProductQuantizer is only available for the pq spaces (l2-pq, ip-pq, cosine-pq).");
+      }
+      if (index_ != nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The product quantizer cannot be retrained once the index has been initialized.\n");
+        throw std::runtime_error("The product quantizer cannot be retrained once the index has been initialized.");
+      }
+      if (numSubvectors == 0 || dim_ % numSubvectors != 0) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Invalid number of subvectors %u, it must divide the dimension %u.\n", numSubvectors, dim_);
+        throw std::invalid_argument("Invalid number of subvectors " + std::to_string(numSubvectors) + ", it must divide the dimension " + std::to_string(dim_) + ".");
+      }
+
+      std::vector<float> flat = internal::flattenSamples(samples, dim_, normalize_);
+      pqSpace_->train(flat.data(), samples.size(), numSubvectors, iterations);
+    }
+
+    bool isQuantizerTrained() const {
+      return pqSpace_ != nullptr && pqSpace_->isTrained();
+    }
+
+    void requireTrainedProductQuantizer() const {
+      if (pqSpace_ != nullptr && !pqSpace_->isTrained()) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The product quantizer has not been trained, call `trainProductQuantizer` in advance.\n");
+        throw std::runtime_error("The product quantizer has not been trained, call `trainProductQuantizer` in advance.");
+      }
+    }
+
     void readIndex(const std::string& filename) {
       if (index_) delete index_;
+      index_ = nullptr;
+
+      if (pqSpace_ != nullptr) {
+        internal::readQuantizerParams(*pqSpace_, filename + ".pq");
+      }
 
       try {
         index_ = new hnswlib::BruteforceSearch<float>(space_, filename);
@@ -390,9 +824,9 @@ namespace emscripten {
         std::string target = "The maximum number of elements has been reached";
 
         if (errorMessage.find(target) != std::string::npos) {
-          printf("The maximum number of elements in the index has been reached. , please increased the index max_size.  max_size: %zu\n", index_->maxelements_);
+          printf("The maximum number of elements in the index has been reached. , please increased the index max_size.\n");
 
-          throw std::runtime_error("The maximum number of elements in the index has been reached. , please increased the index max_size.  max_size: " + std::to_string(index_->maxelements_));
+          throw std::runtime_error("The maximum number of elements in the index has been reached. , please increased the index max_size.");
         }
         else {
           // Re-throw the original error if it's not the one you're looking for
@@ -416,6 +850,9 @@ namespace emscripten {
       }
 
       index_->saveIndex(filename);
+      if (pqSpace_ != nullptr) {
+        internal::writeQuantizerParams(*pqSpace_, filename + ".pq");
+      }
       EmscriptenFileSystemManager::syncFS(false, emscripten::val::undefined());
     }
 
@@ -436,8 +873,16 @@ namespace emscripten {
         throw std::runtime_error("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: " + std::to_string(index_->maxelements_));
       }
 
+      std::vector<uint8_t> code;
+      const void* point = mutableVec.data();
+      if (pqSpace_ != nullptr) {
+        code.resize(pqSpace_->get_data_size());
+        pqSpace_->encode(mutableVec.data(), code.data());
+        point = code.data();
+      }
+
       try {
-        index_->addPoint(reinterpret_cast<void*>(mutableVec.data()), static_cast<hnswlib::labeltype>(idx));
+        index_->addPoint(point, static_cast<hnswlib::labeltype>(idx));
       }
       catch (const std::exception& e) {
         throw std::runtime_error("HNSWLIB ERROR: " + std::string(e.what()));
@@ -471,10 +916,7 @@ namespace emscripten {
         throw std::invalid_argument("Invalid the number of k-nearest neighbors (must be a positive number).");
       }
 
-      CustomFilterFunctor* filterFnCpp = nullptr;
-      if (!js_filterFn.isNull() && !js_filterFn.isUndefined()) {
-        filterFnCpp = new CustomFilterFunctor(js_filterFn);
-      }
+      SearchFilter filter(js_filterFn);
 
       std::vector<float>& mutableVec = const_cast<std::vector<float>&>(vec);
 
@@ -482,8 +924,19 @@ namespace emscripten {
         internal::normalizePoints(mutableVec);
       }
 
+      // the pq spaces scan the codes with the query table, one lookup per subvector
+      std::vector<float> table;
+      const void* query = mutableVec.data();
+      if (pqSpace_ != nullptr) {
+        table.resize(pqSpace_->getQueryTableSize());
+        pqSpace_->computeQueryTable(mutableVec.data(), table.data());
+        query = table.data();
+      }
+
+      // the scan is split across the worker threads unless the filter has to run on the main thread
+      const size_t numThreads = filter.callsJs() ? 1 : internal::resolveNumThreads(0);
       std::priority_queue<std::pair<float, size_t>> knn =
-        index_->searchKnn(reinterpret_cast<void*>(const_cast<float*>(mutableVec.data())), static_cast<size_t>(k), filterFnCpp);
+        index_->searchKnn(query, static_cast<size_t>(k), filter.get(), numThreads);
       const size_t n_results = knn.size();
       emscripten::val distances = emscripten::val::array();
       emscripten::val neighbors = emscripten::val::array();
@@ -497,8 +950,6 @@ namespace emscripten {
         knn.pop();
       }
 
-      if (filterFnCpp) delete filterFnCpp;
-
       emscripten::val results = emscripten::val::object();
       results.set("distances", distances);
       results.set("neighbors", neighbors);
@@ -539,13 +990,37 @@ namespace emscripten {
     std::mutex mutate_lock_;
     /// @brief Lock for cache
     std::mutex label_cache_lock_;
-    /// @brief Cache for used labels populated from index_ by updateUsedLabelsCache()
+    /// @brief Set by every change, the label caches below are refreshed on their next read
     bool updateCache_ = false;
+    /// @brief Cache for used labels populated from index_ by updateLabelCaches()
     std::vector<uint32_t> usedLabelsCache_;
-    /// @brief Cache for deleted labels populated from index_ by updateDeletedLabelsCache()
+    /// @brief Cache for deleted labels populated from index_ by updateLabelCaches()
     std::vector<uint32_t> deletedLabelsCache_;
+    /// @brief Labels for addItems, see generateLabels
+    internal::LabelAllocator labelAllocator_;
     bool normalize_;
     std::string autoSaveFilename_ = "";
+    /// @brief True once index_ matches a snapshot of autoSaveFilename_ (written or read), deltas can then be written on top of it
+    bool hasAutoSaveSnapshot_ = false;
+    /// @brief Number of `<autoSaveFilename_>.delta.<n>` files on top of the snapshot
+    size_t autoSaveDeltaCount_ = 0;
+    /// @brief Deltas written before autoSaveIndex compacts them into a new snapshot
+    static constexpr size_t MAX_AUTOSAVE_DELTAS = 32;
+    /// @brief Auto save scheduling, see setAutoSaveOptions.  The default debounce of 0 saves synchronously after every change
+    double autoSaveDebounceMs_ = 0;
+    uint32_t autoSaveMaxPendingChanges_ = 0;
+    double autoSaveMaxLatencyMs_ = 0;
+    /// @brief Changes since the last auto save, and the time of the first one
+    uint32_t autoSavePendingChanges_ = 0;
+    double autoSaveFirstPendingMs_ = 0;
+    /// @brief emscripten_set_timeout id of the scheduled auto save, 0 when none is scheduled
+    long autoSaveTimer_ = 0;
+    /// @brief Set for the sq8 spaces, points to space_.  Vectors are encoded to 8 bit codes before they reach index_
+    hnswlib::SQ8Space* sq8Space_ = nullptr;
+    /// @brief sq8 spaces only, searches fetch rerankFactor_ * k candidates and rerank them with the float query
+    uint32_t rerankFactor_ = 1;
+    /// @brief Set for the pq spaces, points to space_.  Vectors are encoded to product quantization codes, queries to lookup tables
+    hnswlib::PQSpace* pqSpace_ = nullptr;
 
 
     HierarchicalNSW(const std::string& space_name, uint32_t dim, const std::string& autoSaveFilename)
@@ -561,13 +1036,29 @@ namespace emscripten {
         space_ = new hnswlib::InnerProductSpace(static_cast<size_t>(dim_));
         normalize_ = true;
       }
+      else if (space_name == "l2-sq8" || space_name == "ip-sq8" || space_name == "cosine-sq8") {
+        sq8Space_ = new hnswlib::SQ8Space(static_cast<size_t>(dim_), space_name != "l2-sq8");
+        space_ = sq8Space_;
+        normalize_ = space_name == "cosine-sq8";
+      }
+      else if (space_name == "l2-pq" || space_name == "ip-pq" || space_name == "cosine-pq") {
+        pqSpace_ = new hnswlib::PQSpace(static_cast<size_t>(dim_), space_name != "l2-pq");
+        space_ = pqSpace_;
+        normalize_ = space_name == "cosine-pq";
+      }
       else {
-        if (EmscriptenFileSystemManager::debugLogs) printf("invalid space should be expected l2, ip, or cosine, name: %s\n", space_name.c_str());
-        throw std::invalid_argument("invalid space should be expected l2, ip, or cosine, name: " + space_name);
+        if (EmscriptenFileSystemManager::debugLogs) printf("invalid space should be expected l2, ip, or cosine (or l2-sq8, ip-sq8, cosine-sq8, l2-pq, ip-pq, cosine-pq), name: %s\n", space_name.c_str());
+        throw std::invalid_argument("invalid space should be expected l2, ip, or cosine (or l2-sq8, ip-sq8, cosine-sq8, l2-pq, ip-pq, cosine-pq), name: " + space_name);
       }
     }
 
     ~HierarchicalNSW() {
+      try {
+        flushAutoSave(emscripten::val::undefined());
+      }
+      catch (const std::exception& e) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("AutoSave failed: %s\n", e.what());
+      }
       if (space_) delete space_;
       if (index_) delete index_;
     }
@@ -583,37 +1074,77 @@ namespace emscripten {
 
 
     void initIndex(uint32_t max_elements, uint32_t m = 16, uint32_t ef_construction = 200, uint32_t random_seed = 100) {
+      // the pq code size is only known once the codebooks are trained
+      if (pqSpace_ != nullptr) requireTrainedQuantizer();
+      // changes of the index being replaced are saved first
+      flushAutoSave(emscripten::val::undefined());
       if (index_) delete index_;
 
       index_ = new hnswlib::HierarchicalNSW<float>(space_, max_elements, m, ef_construction, random_seed, true);
+      index_->setDirtyTracking(autoSaveFilename_ != "");
+      labelAllocator_.reset(*index_);
+      hasAutoSaveSnapshot_ = false;
+      autoSaveDeltaCount_ = 0;
     }
 
     void readIndex(const std::string& filename, uint32_t max_elements) {
-      if (index_) delete index_;
+      flushAutoSave(emscripten::val::undefined());
 
       const std::string path = EmscriptenFileSystemManager::virtualDirectory + "/" + filename;
 
+      // the index in use is only replaced once the snapshot and its deltas are read, a failed read keeps it
+      // unless the quantizer it was encoded with has been overwritten
+      const bool hasQuantizer = sq8Space_ != nullptr || pqSpace_ != nullptr;
+      std::unique_ptr<hnswlib::HierarchicalNSW<float>> index;
+      size_t deltaCount = 0;
       try {
-        index_ = new hnswlib::HierarchicalNSW<float>(space_, path, false, max_elements, true);
-
-        updateLabelCaches();
+        if (hasQuantizer) {
+          readQuantizer(path);
+        }
+        index.reset(new hnswlib::HierarchicalNSW<float>(space_, path, false, max_elements, true));
+        deltaCount = readDeltas(*index, path);
       }
       catch (const std::runtime_error& e) {
+        if (hasQuantizer && index_) {
+          delete index_;
+          index_ = nullptr;
+        }
         std::string errorMessage(e.what());
         std::string target = "The maximum number of elements has been reached";
 
         if (errorMessage.find(target) != std::string::npos) {
-          throw std::runtime_error("The maximum number of elements in the index has been reached. , please increased the index max_size.  max_size: " + std::to_string(index_->max_elements_));
+          throw std::runtime_error("The maximum number of elements in the index has been reached. , please increased the index max_size.  max_size: " + std::to_string(max_elements));
         }
         else {
           // Re-throw the original error if it's not the one you're looking for
           throw;
         }
       }
+      catch (...) {
+        if (hasQuantizer && index_) {
+          delete index_;
+          index_ = nullptr;
+        }
+        throw;
+      }
+
+      if (index_) delete index_;
+      index_ = index.release();
+      index_->setDirtyTracking(autoSaveFilename_ != "");
+      hasAutoSaveSnapshot_ = filename == autoSaveFilename_;
+      autoSaveDeltaCount_ = hasAutoSaveSnapshot_ ? deltaCount : 0;
+      labelAllocator_.reset(*index_);
 
+      updateCache_ = true;
     }
 
     void writeIndex(const std::string& filename) {
+      writeIndexFiles(filename);
+      EmscriptenFileSystemManager::syncFS(false, emscripten::val::undefined());
+    }
+
+    /// @brief writeIndex without the IDBFS sync
+    void writeIndexFiles(const std::string& filename) {
       if (EmscriptenFileSystemManager::debugLogs) printf("WriteIndex filename: %s\n", filename.c_str());
 
       if (index_ == nullptr) {
@@ -621,21 +1152,281 @@ namespace emscripten {
       }
       const std::string path = EmscriptenFileSystemManager::virtualDirectory + "/" + filename;
       index_->saveIndex(path);
-      EmscriptenFileSystemManager::syncFS(false, emscripten::val::undefined());
+      if (sq8Space_ != nullptr || pqSpace_ != nullptr) {
+        writeQuantizer(path);
+      }
+      // the snapshot contains every change, older deltas of this file would be applied twice
+      removeDeltas(path);
+      if (filename == autoSaveFilename_) {
+        index_->clearDirty();
+        hasAutoSaveSnapshot_ = true;
+        autoSaveDeltaCount_ = 0;
+      }
+    }
+
+    /// @brief Deltas of a snapshot are stored next to it in `<filename>.delta.1` ... `<filename>.delta.<n>` and applied in order
+    static std::string deltaPath(const std::string& path, size_t sequence) {
+      return path + ".delta." + std::to_string(sequence);
+    }
+
+    /// @brief Applies the deltas of the snapshot just read into index, returns their number
+    static size_t readDeltas(hnswlib::HierarchicalNSW<float>& index, const std::string& path) {
+      size_t sequence = 0;
+      while (std::ifstream(deltaPath(path, sequence + 1)).good()) {
+        sequence++;
+        index.loadDelta(deltaPath(path, sequence));
+      }
+      return sequence;
+    }
+
+    static void removeDeltas(const std::string& path) {
+      for (size_t sequence = 1; std::remove(deltaPath(path, sequence).c_str()) == 0; sequence++) {
+      }
+    }
+
+    /// @brief A delta is written when it is small next to the index, otherwise a new snapshot is cheaper to write and faster to read
+    bool canWriteAutoSaveDelta() {
+      return hasAutoSaveSnapshot_ && autoSaveDeltaCount_ < MAX_AUTOSAVE_DELTAS &&
+        index_->getDirtyCount() * 4 < index_->cur_element_count;
+    }
+
+    /// @brief The sq8 ranges are stored next to the index in `<filename>.sq8`, the pq codebooks in `<filename>.pq`
+    void writeQuantizer(const std::string& path) {
+      if (sq8Space_ != nullptr) internal::writeQuantizerParams(*sq8Space_, path + ".sq8");
+      if (pqSpace_ != nullptr) internal::writeQuantizerParams(*pqSpace_, path + ".pq");
+    }
+
+    void readQuantizer(const std::string& path) {
+      if (sq8Space_ != nullptr) internal::readQuantizerParams(*sq8Space_, path + ".sq8");
+      if (pqSpace_ != nullptr) internal::readQuantizerParams(*pqSpace_, path + ".pq");
+    }
+
+    /// @brief Trains the 8 bit quantizer of the sq8 spaces on sample vectors, it must be called before points are added.
+    /// @param samples vectors representative of the data, their min/max become the quantization range
+    /// @param perDimension one range per dimension instead of one range for all dimensions
+    void trainQuantizer(const std::vector<std::vector<float>>& samples, bool perDimension) {
+      std::lock_guard<std::mutex> lock(mutate_lock_);
+      if (sq8Space_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("trainQuantizer is only available for the sq8 spaces (l2-sq8, ip-sq8, cosine-sq8).\n");
+        throw std::invalid_argument("trainQuantizer is only available for the sq8 spaces (l2-sq8, ip-sq8, cosine-sq8).");
+      }
+      if (index_ != nullptr && index_->cur_element_count > 0) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The quantizer cannot be retrained once points have been added.\n");
+        throw std::runtime_error("The quantizer cannot be retrained once points have been added.");
+      }
+
+      std::vector<float> flat = internal::flattenSamples(samples, dim_, normalize_);
+      sq8Space_->train(flat.data(), samples.size(), perDimension);
+    }
+
+    /// @brief Trains the product quantizer of the pq spaces on sample vectors, it must be called before `initIndex`.
+    /// @param samples vectors representative of the data, the codebooks are trained with k-means on them
+    /// @param numSubvectors bytes per stored vector, the dimension must be divisible by it
+    /// @param iterations k-means iterations
+    void trainProductQuantizer(const std::vector<std::vector<float>>& samples, uint32_t numSubvectors, uint32_t iterations) {
+      std::lock_guard<std::mutex> lock(mutate_lock_);
+      if (pqSpace_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("trainProductQuantizer is only available for the pq spaces (l2-pq, ip-pq, cosine-pq).\n");
+        throw std::invalid_argument("trainProductQuantizer is only available for the pq spaces (l2-pq, ip-pq, cosine-pq).");
+      }
+      if (index_ != nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The product quantizer cannot be retrained once the index has been initialized.\n");
+        throw std::runtime_error("The product quantizer cannot be retrained once the index has been initialized.");
+      }
+      if (numSubvectors == 0 || dim_ % numSubvectors != 0) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Invalid number of subvectors %u, it must divide the dimension %u.\n", numSubvectors, dim_);
+        throw std::invalid_argument("Invalid number of subvectors " + std::to_string(numSubvectors) + ", it must divide the dimension " + std::to_string(dim_) + ".");
+      }
+
+      std::vector<float> flat = internal::flattenSamples(samples, dim_, normalize_);
+      pqSpace_->train(flat.data(), samples.size(), numSubvectors, iterations);
+    }
+
+    bool isQuantizerTrained() const {
+      return (sq8Space_ != nullptr && sq8Space_->isTrained()) || (pqSpace_ != nullptr && pqSpace_->isTrained());
+    }
+
+    uint32_t getRerankFactor() const {
+      return rerankFactor_;
+    }
+
+    /// @brief sq8 spaces only, a factor above 1 fetches factor * k candidates and reranks them with the float query
+    void setRerankFactor(uint32_t factor) {
+      rerankFactor_ = std::max<uint32_t>(1, factor);
+    }
+
+    void requireTrainedQuantizer() const {
+      if (sq8Space_ != nullptr && !sq8Space_->isTrained()) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The quantizer has not been trained, call `trainQuantizer` in advance.\n");
+        throw std::runtime_error("The quantizer has not been trained, call `trainQuantizer` in advance.");
+      }
+      if (pqSpace_ != nullptr && !pqSpace_->isTrained()) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The product quantizer has not been trained, call `trainProductQuantizer` in advance.\n");
+        throw std::runtime_error("The product quantizer has not been trained, call `trainProductQuantizer` in advance.");
+      }
+    }
+
+    /// @brief Floats of scratch space prepareRow needs per row
+    size_t rowScratchSize() const {
+      const size_t codeBytes = sq8Space_ != nullptr ? sq8Space_->get_data_size() : pqSpace_ != nullptr ? pqSpace_->get_data_size() : 0;
+      const size_t codeSize = (codeBytes + sizeof(float) - 1) / sizeof(float);
+      return (normalize_ || codeBytes > 0 ? dim_ : 0) + codeSize;
+    }
+
+    /// @brief Converts a float row into what index_ stores: normalized for cosine spaces, encoded for sq8 and pq spaces.  The row is never modified.
+    const void* prepareRow(const float* row, float* scratch) const {
+      if (normalize_) {
+        std::copy(row, row + dim_, scratch);
+        internal::normalizePointsPtrs(scratch, dim_);
+        row = scratch;
+      }
+      if (sq8Space_ != nullptr) {
+        void* code = scratch + dim_;
+        sq8Space_->encode(row, code);
+        return code;
+      }
+      if (pqSpace_ != nullptr) {
+        void* code = scratch + dim_;
+        pqSpace_->encode(row, code);
+        return code;
+      }
+      return row;
     }
 
+    /// @brief Searches index_ with a float query.  With a rerank factor the sq8 spaces fetch more candidates and rerank them against the float query.
+    std::priority_queue<std::pair<float, hnswlib::labeltype>> searchRow(const float* query, size_t k, hnswlib::BaseFilterFunctor* filter) const {
+      requireTrainedQuantizer();
+      if (pqSpace_ != nullptr) {
+        // the query table is computed once and read by every distance of the search, see PQSpace::computeQueryTable
+        std::vector<float> table(dim_ + pqSpace_->getQueryTableSize());
+        if (normalize_) {
+          std::copy(query, query + dim_, table.data());
+          internal::normalizePointsPtrs(table.data(), dim_);
+          query = table.data();
+        }
+        pqSpace_->computeQueryTable(query, table.data() + dim_);
+        return index_->searchKnn(table.data() + dim_, k, filter);
+      }
+      std::vector<float> scratch(rowScratchSize());
+      const void* prepared = prepareRow(query, scratch.data());
+      if (sq8Space_ == nullptr || rerankFactor_ <= 1) {
+        return index_->searchKnn(prepared, k, filter);
+      }
+
+      const float* floatQuery = normalize_ ? scratch.data() : query;
+      std::priority_queue<std::pair<float, hnswlib::labeltype>> candidates = index_->searchKnn(prepared, k * rerankFactor_, filter);
+      std::priority_queue<std::pair<float, hnswlib::labeltype>> result;
+      for (; !candidates.empty(); candidates.pop()) {
+        const hnswlib::labeltype label = candidates.top().second;
+        // getDataByLabel reads the dim leading bytes, the codes
+        std::vector<uint8_t> code = index_->getDataByLabel<uint8_t>(label);
+        result.emplace(sq8Space_->asymmetricDistance(floatQuery, code.data()), label);
+        if (result.size() > k) result.pop();
+      }
+      return result;
+    }
+
+    /// @brief Called after every change.  Saves right away, or coalesces the changes into one save scheduled on the event loop, see setAutoSaveOptions
     void autoSaveIndex() {
-      if (autoSaveFilename_ != "" && EmscriptenFileSystemManager::isInitialized()) {
-        if (EmscriptenFileSystemManager::debugLogs) printf("AutoSave filename: %s\n", autoSaveFilename_.c_str());
-        writeIndex(autoSaveFilename_);
+      updateCache_ = true;
+      if (autoSaveFilename_ == "" || !EmscriptenFileSystemManager::isInitialized()) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("AutoSave not enabled or not initialized\n");
+        return;
+      }
+
+      const double now = emscripten_get_now();
+      if (autoSavePendingChanges_++ == 0) {
+        autoSaveFirstPendingMs_ = now;
+      }
+      const double deadline = autoSaveMaxLatencyMs_ > 0 ? autoSaveFirstPendingMs_ + autoSaveMaxLatencyMs_ : std::numeric_limits<double>::max();
+      if (autoSaveDebounceMs_ <= 0 || now >= deadline ||
+        (autoSaveMaxPendingChanges_ > 0 && autoSavePendingChanges_ >= autoSaveMaxPendingChanges_)) {
+        saveAutoSaveFiles();
+        EmscriptenFileSystemManager::syncFS(false, emscripten::val::undefined());
+        return;
+      }
+
+      // every change restarts the debounce window, up to the max latency
+      if (autoSaveTimer_ != 0) emscripten_clear_timeout(autoSaveTimer_);
+      autoSaveTimer_ = emscripten_set_timeout(&HierarchicalNSW::autoSaveTimerCallback, std::min(autoSaveDebounceMs_, deadline - now), this);
+    }
+
+    /// @brief Writes the pending changes to the auto save file, as a delta when they are small.  The IDBFS sync is left to the caller
+    void saveAutoSaveFiles() {
+      if (autoSaveTimer_ != 0) {
+        emscripten_clear_timeout(autoSaveTimer_);
+        autoSaveTimer_ = 0;
+      }
+      autoSavePendingChanges_ = 0;
+      if (EmscriptenFileSystemManager::debugLogs) printf("AutoSave filename: %s\n", autoSaveFilename_.c_str());
+      if (canWriteAutoSaveDelta()) {
+        // only the changed elements are written, the snapshot file is left untouched for the IDBFS sync
+        const std::string path = EmscriptenFileSystemManager::virtualDirectory + "/" + autoSaveFilename_;
+        index_->saveDelta(deltaPath(path, autoSaveDeltaCount_ + 1));
+        autoSaveDeltaCount_++;
       }
       else {
-        if (EmscriptenFileSystemManager::debugLogs) printf("AutoSave not enabled or not initialized\n");
+        writeIndexFiles(autoSaveFilename_);
+      }
+    }
+
+    static void autoSaveTimerCallback(void* userData) {
+      HierarchicalNSW* self = static_cast<HierarchicalNSW*>(userData);
+      std::lock_guard<std::mutex> lock(self->mutate_lock_);
+      self->autoSaveTimer_ = 0;
+      if (self->autoSavePendingChanges_ == 0 || self->index_ == nullptr) return;
+      try {
+        self->saveAutoSaveFiles();
+        EmscriptenFileSystemManager::syncFS(false, emscripten::val::undefined());
+      }
+      catch (const std::exception& e) {
+        // nothing to throw to on the event loop, the changes stay pending for the next save
+        printf("AutoSave failed: %s\n", e.what());
+      }
+    }
+
+    /// @brief Configures the auto save.  Changes are coalesced until none happened for debounceMs, maxPendingChanges changes are pending
+    /// or the first pending change is maxLatencyMs old, then saved once.  0 disables the respective limit, a debounce of 0 saves after every change.
+    void setAutoSaveOptions(double debounceMs, uint32_t maxPendingChanges, double maxLatencyMs) {
+      std::lock_guard<std::mutex> lock(mutate_lock_);
+      autoSaveDebounceMs_ = std::max(0.0, debounceMs);
+      autoSaveMaxPendingChanges_ = maxPendingChanges;
+      autoSaveMaxLatencyMs_ = std::max(0.0, maxLatencyMs);
+    }
+
+    uint32_t getPendingAutoSaveChanges() const {
+      return autoSavePendingChanges_;
+    }
+
+    /// @brief Saves the pending auto save changes now.  The callback is called once the files are synced to IDBFS
+    void flushAutoSave(emscripten::val callback) {
+      bool saved = false;
+      {
+        std::lock_guard<std::mutex> lock(mutate_lock_);
+        if (autoSavePendingChanges_ > 0 && index_ != nullptr) {
+          saveAutoSaveFiles();
+          saved = true;
+        }
+        else if (autoSaveTimer_ != 0) {
+          emscripten_clear_timeout(autoSaveTimer_);
+          autoSaveTimer_ = 0;
+        }
+      }
+      if (!saved && callback.isUndefined()) {
+        return;
+      }
+      // the sync is queued behind the ones in flight, so the callback also waits for earlier auto saves
+      if (EmscriptenFileSystemManager::isInitialized()) {
+        EmscriptenFileSystemManager::syncFS(false, callback);
+      }
+      else if (!callback.isUndefined()) {
+        callback.call<void>("call", emscripten::val::undefined());
       }
-      updateCache_ = true;
     }
 
     void resizeIndex(uint32_t new_max_elements) {
+      std::lock_guard<std::mutex> lock(mutate_lock_);
+
       if (index_ == nullptr) {
         throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
       }
@@ -651,7 +1442,21 @@ namespace emscripten {
       }
 
       try {
-        std::vector<float> vec = index_->getDataByLabel<float>(static_cast<size_t>(label));
+        std::vector<float> vec;
+        if (sq8Space_ != nullptr) {
+          std::vector<uint8_t> code = index_->getDataByLabel<uint8_t>(static_cast<size_t>(label));
+          vec.resize(dim_);
+          sq8Space_->decode(code.data(), vec.data());
+        }
+        else if (pqSpace_ != nullptr) {
+          // getDataByLabel reads M bytes, the first field of the pq parameters
+          std::vector<uint8_t> code = index_->getDataByLabel<uint8_t>(static_cast<size_t>(label));
+          vec.resize(dim_);
+          pqSpace_->decode(code.data(), vec.data());
+        }
+        else {
+          vec = index_->getDataByLabel<float>(static_cast<size_t>(label));
+        }
         val point = val::array();
         for (size_t i = 0; i < vec.size(); i++) point.set(i, vec[i]);
         return point;
@@ -677,30 +1482,20 @@ namespace emscripten {
       return deletedLabelsCache_;
     }
 
-    /// @brief Update local used and deleted labels cache
+    /// @brief Update local used and deleted labels cache, called with label_cache_lock_ held.
+    /// One pass over the elements and their delete marks, no label map is built
     void updateLabelCaches() {
-      std::lock_guard<std::mutex> lock(label_cache_lock_);
-      std::vector<uint32_t> usedLabels;
-      std::vector<uint32_t> deletedLabels;
-      std::unordered_map<hnswlib::tableint, hnswlib::labeltype> reverse_label_lookup;
       updateCache_ = false;
+      usedLabelsCache_.clear();
+      deletedLabelsCache_.clear();
+      if (index_ == nullptr) return;
 
-      for (const auto& kv : index_->label_lookup_) {
-        reverse_label_lookup[kv.second] = kv.first;
-        if (index_->deleted_elements.find(kv.second) == index_->deleted_elements.end()) {
-          usedLabels.push_back(static_cast<uint32_t>(kv.first));
-        }
+      for (const hnswlib::labeltype label : index_->getLabels(false)) {
+        usedLabelsCache_.push_back(static_cast<uint32_t>(label));
       }
-
-      for (const auto& element : index_->deleted_elements) {
-        auto it = reverse_label_lookup.find(element);
-        if (it != reverse_label_lookup.end()) {
-          deletedLabels.push_back(static_cast<uint32_t>(it->second));
-        }
+      for (const hnswlib::labeltype label : index_->getLabels(true)) {
+        deletedLabelsCache_.push_back(static_cast<uint32_t>(label));
       }
-
-      usedLabelsCache_ = std::move(usedLabels);
-      deletedLabelsCache_ = std::move(deletedLabels);
     }
 
 
@@ -711,42 +1506,82 @@ namespace emscripten {
     /// @param replace_deleted true if we want to reuse deleted labels
     /// @return 
     std::vector<uint32_t> generateLabels(size_t size, bool replace_deleted) {
-      std::vector<uint32_t> labels;
+      return labelAllocator_.allocate(size, replace_deleted, *index_);
+    }
 
-      {
-        std::lock_guard<std::mutex> guard1(index_->label_lookup_lock);
-        std::lock_guard<std::mutex> guard2(index_->deleted_elements_lock);
-
-        // Determine the current maxLabel, its incremented later before use
-        int64_t maxLabel = -1;
-        for (const auto& pair : index_->label_lookup_) {
-          if (pair.first > maxLabel) {
-            maxLabel = pair.first;
-          }
-        }
+    std::vector<uint32_t> addItems(const std::vector<std::vector<float>>& vec, bool replace_deleted = false) {
+      return addItemsWithThreads(vec, 1, replace_deleted);
+    }
 
-        if (replace_deleted) {
-          // Fill with deleted labels first
-          for (const auto& pair : index_->label_lookup_) {
-            if (index_->deleted_elements.find(pair.second) != index_->deleted_elements.end()) {
-              labels.push_back(static_cast<uint32_t>(pair.first));
-              if (labels.size() == size) {
-                return labels;
-              }
-            }
-          }
-        }
+    /// @brief Same as addItems, but inserts the vectors on numThreads threads.  Only the threads build runs in parallel, other builds insert serially.
+    /// @param vec 
+    /// @param numThreads number of threads, 0 uses one thread per core
+    /// @param replace_deleted 
+    /// @return 
+    std::vector<uint32_t> addItemsParallel(const std::vector<std::vector<float>>& vec, uint32_t numThreads, bool replace_deleted = false) {
+      return addItemsWithThreads(vec, internal::resolveNumThreads(numThreads), replace_deleted);
+    }
+
+    std::vector<uint32_t> addItemsWithThreads(const std::vector<std::vector<float>>& vec, size_t numThreads, bool replace_deleted) {
+      std::lock_guard<std::mutex> lock(mutate_lock_);
+
+      if (index_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
+        throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
+      }
+
+      if (vec.size() <= 0) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The number of vectors and ids must be greater than 0.\n");
+        throw std::runtime_error("The number of vectors and ids must be greater than 0.");
+      }
 
-        // If not enough deleted labels or replace_deleted is false, generate new ones
-        while (labels.size() < size) {
-          labels.push_back(static_cast<uint32_t>(++maxLabel));
+      if (index_->cur_element_count + vec.size() > index_->max_elements_) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: %zu\n", index_->max_elements_);
+        throw std::runtime_error("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: " + std::to_string(index_->max_elements_));
+      }
+
+      for (size_t i = 0; i < vec.size(); ++i) {
+        if (vec[i].size() != dim_) {
+          if (EmscriptenFileSystemManager::debugLogs) printf("Invalid vector size at index %zu. Must be equal to the dimension of the space. The dimension of the space is %d.\n", i, dim_);
+          throw std::runtime_error("Could not addItems Invalid vector size at index " + std::to_string(i) + ". Must be equal to the dimension of the space. The dimension of the space is " + std::to_string(this->dim_) + ".");
         }
       }
 
-      return labels;
+      // Generate labels for the vectors to be added
+      std::vector<uint32_t> labels = generateLabels(vec.size(), replace_deleted);
+
+      try {
+        addRows(vec.size(), [&](size_t i) { return vec[i].data(); }, labels.data(), numThreads, replace_deleted);
+        autoSaveIndex();
+        return labels;
+      }
+      catch (const std::exception& e) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Could not addItems %s\n", e.what());
+        throw std::runtime_error("Could not addItems " + std::string(e.what()));
+      }
     }
 
-    std::vector<uint32_t> addItems(const std::vector<std::vector<float>>& vec, bool replace_deleted = false) {
+    /// @brief Inserts count rows, getRow(i) returns the dim_ floats of row i.  Rows are never modified, see prepareRow.
+    template <class GetRow>
+    void addRows(size_t count, GetRow getRow, const uint32_t* labels, size_t numThreads, bool replace_deleted) {
+      requireTrainedQuantizer();
+
+      labelAllocator_.addUsed(labels, count);
+
+      const size_t scratchSize = rowScratchSize();
+      std::vector<float> scratch(numThreads * scratchSize);
+      internal::ParallelFor(0, count, numThreads, [&](size_t i, size_t threadId) {
+        const void* row = prepareRow(getRow(i), scratch.data() + threadId * scratchSize);
+        index_->addPoint(row, static_cast<hnswlib::labeltype>(labels[i]), replace_deleted);
+      });
+    }
+
+    /// @brief Zero copy version of addItems.  Reads count * dim floats straight from the wasm heap, see `allocateHeapFloat32Array` in index.ts
+    /// @param dataPtr byte offset of the first float in HEAPF32, as returned by Module._malloc
+    /// @param count number of vectors
+    /// @param replace_deleted 
+    /// @return labels of the added vectors
+    std::vector<uint32_t> addItemsFromHeap(uintptr_t dataPtr, uint32_t count, bool replace_deleted = false) {
       std::lock_guard<std::mutex> lock(mutate_lock_);
 
       if (index_ == nullptr) {
@@ -754,43 +1589,61 @@ namespace emscripten {
         throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
       }
 
-      if (vec.size() <= 0) {
+      if (count <= 0) {
         if (EmscriptenFileSystemManager::debugLogs) printf("The number of vectors and ids must be greater than 0.\n");
         throw std::runtime_error("The number of vectors and ids must be greater than 0.");
       }
 
-      if (index_->cur_element_count + vec.size() > index_->max_elements_) {
+      if (index_->cur_element_count + count > index_->max_elements_) {
         if (EmscriptenFileSystemManager::debugLogs) printf("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: %zu\n", index_->max_elements_);
         throw std::runtime_error("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: " + std::to_string(index_->max_elements_));
       }
 
-      {
-        std::lock_guard<std::mutex> lock(index_->global);
-        // Generate labels for the vectors to be added
-        std::vector<uint32_t> labels = generateLabels(vec.size(), replace_deleted);
+      const float* data = internal::heapPointer<const float>(dataPtr);
+      std::vector<uint32_t> labels = generateLabels(count, replace_deleted);
 
-        try {
-          for (size_t i = 0; i < vec.size(); ++i) {
-            if (vec[i].size() != dim_) {
-              if (EmscriptenFileSystemManager::debugLogs) printf("Invalid vector size at index %zu. Must be equal to the dimension of the space. The dimension of the space is %d.\n", i, dim_);
-              throw std::invalid_argument("Invalid vector size at index " + std::to_string(i) + ". Must be equal to the dimension of the space. The dimension of the space is " + std::to_string(this->dim_) + ".");
-            }
+      try {
+        addRows(count, [&](size_t i) { return data + i * dim_; }, labels.data(), 1, replace_deleted);
+        autoSaveIndex();
+        return labels;
+      }
+      catch (const std::exception& e) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Could not addItems %s\n", e.what());
+        throw std::runtime_error("Could not addItems " + std::string(e.what()));
+      }
+    }
 
-            std::vector<float>& mutableVec = const_cast<std::vector<float>&>(vec[i]);
+    /// @brief Zero copy version of addPoints.  Reads count * dim floats and count labels straight from the wasm heap
+    /// @param dataPtr byte offset of the first float in HEAPF32
+    /// @param labelsPtr byte offset of the first label in HEAPU32
+    /// @param count number of vectors
+    /// @param replace_deleted 
+    void addPointsFromHeap(uintptr_t dataPtr, uintptr_t labelsPtr, uint32_t count, bool replace_deleted = false) {
+      std::lock_guard<std::mutex> lock(mutate_lock_);
+      if (index_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
+        throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
+      }
 
-            if (normalize_) {
-              internal::normalizePoints(mutableVec);
-            }
+      if (count <= 0) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The number of vectors and ids must be greater than 0.\n");
+        throw std::runtime_error("The number of vectors and ids must be greater than 0.");
+      }
 
-            index_->addPoint(reinterpret_cast<void*>(mutableVec.data()), static_cast<hnswlib::labeltype>(labels[i]), replace_deleted);
-          }
-          autoSaveIndex();
-          return labels;
-        }
-        catch (const std::exception& e) {
-          if (EmscriptenFileSystemManager::debugLogs) printf("Could not addItems %s\n", e.what());
-          throw std::runtime_error("Could not addItems " + std::string(e.what()));
-        }
+      if (index_->cur_element_count + count > index_->max_elements_) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: %zu\n", index_->max_elements_);
+        throw std::runtime_error("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: " + std::to_string(index_->max_elements_));
+      }
+
+      const float* data = internal::heapPointer<const float>(dataPtr);
+      const uint32_t* labels = internal::heapPointer<const uint32_t>(labelsPtr);
+
+      try {
+        addRows(count, [&](size_t i) { return data + i * dim_; }, labels, 1, replace_deleted);
+        autoSaveIndex();
+      }
+      catch (const std::exception& e) {
+        throw std::runtime_error("Could not addPoints " + std::string(e.what()));
       }
     }
 
@@ -807,10 +1660,32 @@ namespace emscripten {
         throw std::invalid_argument("Invalid vector size. Must be equal to the dimension of the space. The dimension of the space is " + std::to_string(this->dim_) + ".");
       }
 
-      std::vector<float>& mutableVec = const_cast<std::vector<float>&>(vec);
+      if (index_->cur_element_count == index_->max_elements_) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: %zu\n", index_->max_elements_);
+        throw std::runtime_error("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: " + std::to_string(index_->max_elements_));
+      }
 
-      if (normalize_) {
-        internal::normalizePoints(mutableVec);
+      try {
+        addRows(1, [&](size_t) { return vec.data(); }, &idx, 1, replace_deleted);
+
+        autoSaveIndex();
+      }
+      catch (const std::exception& e) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("HNSWLIB ERROR: %s\n", e.what());
+        throw std::runtime_error("HNSWLIB ERROR: " + std::string(e.what()));
+      }
+    }
+
+    /// @brief Zero copy version of addPoint.  Reads dim floats straight from the wasm heap
+    /// @param dataPtr byte offset of the first float in HEAPF32
+    /// @param idx 
+    /// @param replace_deleted 
+    void addPointFromHeap(uintptr_t dataPtr, uint32_t idx, bool replace_deleted = false) {
+      std::lock_guard<std::mutex> lock(mutate_lock_);
+
+      if (index_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
+        throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
       }
 
       if (index_->cur_element_count == index_->max_elements_) {
@@ -818,8 +1693,10 @@ namespace emscripten {
         throw std::runtime_error("The maximum number of elements has been reached in index, please increased the index max_size.  max_size: " + std::to_string(index_->max_elements_));
       }
 
+      const float* data = internal::heapPointer<const float>(dataPtr);
+
       try {
-        index_->addPoint(reinterpret_cast<void*>(mutableVec.data()), static_cast<hnswlib::labeltype>(idx), replace_deleted);
+        addRows(1, [&](size_t) { return data; }, &idx, 1, replace_deleted);
 
         autoSaveIndex();
       }
@@ -861,16 +1738,10 @@ namespace emscripten {
             if (EmscriptenFileSystemManager::debugLogs) printf("Invalid vector size at index %zu. Must be equal to the dimension of the space. The dimension of the space is %d.\n", i, dim_);
             throw std::invalid_argument("Invalid vector size at index " + std::to_string(i) + ". Must be equal to the dimension of the space. The dimension of the space is " + std::to_string(this->dim_) + ".");
           }
-
-          std::vector<float>& mutableVec = const_cast<std::vector<float>&>(vec[i]);
-
-          if (normalize_) {
-            internal::normalizePoints(mutableVec);
-          }
-
-          index_->addPoint(reinterpret_cast<void*>(mutableVec.data()), static_cast<hnswlib::labeltype>(idVec[i]), replace_deleted);
         }
 
+        addRows(vec.size(), [&](size_t i) { return vec[i].data(); }, idVec.data(), 1, replace_deleted);
+
         autoSaveIndex();
       }
       catch (const std::exception& e) {
@@ -890,20 +1761,20 @@ namespace emscripten {
     }
 
     void markDelete(uint32_t idx) {
-      std::lock_guard<std::mutex> update_lock(label_cache_lock_);
+      std::lock_guard<std::mutex> lock(mutate_lock_);
       if (index_ == nullptr) {
         if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
         throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
       }
 
       index_->markDelete(static_cast<hnswlib::labeltype>(idx));
+      labelAllocator_.addDeleted(idx);
 
       autoSaveIndex();
-      updateLabelCaches();
     }
 
     void markDeleteItems(const std::vector<uint32_t>& labelsVec) {
-      std::lock_guard<std::mutex> update_lock(label_cache_lock_);
+      std::lock_guard<std::mutex> lock(mutate_lock_);
       if (index_ == nullptr) {
         if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
         throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
@@ -912,10 +1783,10 @@ namespace emscripten {
       try {
         for (const hnswlib::labeltype& label : labelsVec) {
           index_->markDelete(static_cast<hnswlib::labeltype>(label));
+          labelAllocator_.addDeleted(static_cast<uint32_t>(label));
         }
 
         autoSaveIndex();
-        updateLabelCaches();
       }
       catch (const std::exception& e) {
         if (EmscriptenFileSystemManager::debugLogs) printf("Could not markDeleteItems %s\n", e.what());
@@ -925,7 +1796,7 @@ namespace emscripten {
 
 
     void unmarkDelete(uint32_t idx) {
-      std::lock_guard<std::mutex> update_lock(label_cache_lock_);
+      std::lock_guard<std::mutex> lock(mutate_lock_);
       if (index_ == nullptr) {
         if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
         throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
@@ -934,7 +1805,22 @@ namespace emscripten {
       index_->unmarkDelete(static_cast<hnswlib::labeltype>(idx));
 
       autoSaveIndex();
-      updateLabelCaches();
+    }
+
+    void reorderIndex(const std::string& method) {
+      std::lock_guard<std::mutex> lock(mutate_lock_);
+      if (index_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
+        throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
+      }
+      if (method != "bfs" && method != "rcm") {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Invalid reorder method %s, expected bfs or rcm.\n", method.c_str());
+        throw std::invalid_argument("Invalid reorder method " + method + ", expected bfs or rcm.");
+      }
+
+      index_->reorderIndex(method == "bfs" ? hnswlib::HierarchicalNSW<float>::REORDER_BFS : hnswlib::HierarchicalNSW<float>::REORDER_RCM);
+
+      autoSaveIndex();
     }
 
     emscripten::val searchKnn(const std::vector<float>& vec, uint32_t k, emscripten::val js_filterFn = emscripten::val::undefined()) {
@@ -949,6 +1835,24 @@ namespace emscripten {
           std::to_string(vec.size()) + ").");
       }
 
+      return searchKnnRow(vec.data(), k, js_filterFn);
+    }
+
+    /// @brief Zero copy version of searchKnn.  Reads the dim floats of the query straight from the wasm heap
+    /// @param queryPtr byte offset of the first float in HEAPF32
+    /// @param k 
+    /// @param js_filterFn 
+    /// @return 
+    emscripten::val searchKnnFromHeap(uintptr_t queryPtr, uint32_t k, emscripten::val js_filterFn = emscripten::val::undefined()) {
+      if (index_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
+        throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
+      }
+
+      return searchKnnRow(internal::heapPointer<const float>(queryPtr), k, js_filterFn);
+    }
+
+    emscripten::val searchKnnRow(const float* query, uint32_t k, emscripten::val js_filterFn) {
       if (k > index_->max_elements_) {
         if (EmscriptenFileSystemManager::debugLogs) printf("Invalid the number of k-nearest neighbors (cannot be given a value greater than `maxElements`: %zu).\n", index_->max_elements_);
         throw std::invalid_argument("Invalid the number of k-nearest neighbors (cannot be given a value greater than `maxElements`: " +
@@ -959,19 +1863,10 @@ namespace emscripten {
         throw std::invalid_argument("Invalid the number of k-nearest neighbors (must be a positive number).");
       }
 
-      CustomFilterFunctor* filterFnCpp = nullptr;
-      if (!js_filterFn.isNull() && !js_filterFn.isUndefined()) {
-        filterFnCpp = new CustomFilterFunctor(js_filterFn);
-      }
-
+      SearchFilter filter(js_filterFn);
 
-      std::vector<float>& mutableVec = const_cast<std::vector<float>&>(vec);
-      if (normalize_) {
-        internal::normalizePoints(mutableVec);
-      }
-
-      std::priority_queue<std::pair<float, size_t>> knn =
-        index_->searchKnn(reinterpret_cast<void*>(const_cast<float*>(mutableVec.data())), static_cast<size_t>(k), filterFnCpp);
+      // the query is never modified, see prepareRow
+      std::priority_queue<std::pair<float, size_t>> knn = searchRow(query, static_cast<size_t>(k), filter.get());
       const size_t n_results = knn.size();
       emscripten::val distances = emscripten::val::array();
       emscripten::val neighbors = emscripten::val::array();
@@ -984,8 +1879,6 @@ namespace emscripten {
         knn.pop();
       }
 
-      if (filterFnCpp) delete filterFnCpp;
-
       emscripten::val results = emscripten::val::object();
       results.set("distances", distances);
       results.set("neighbors", neighbors);
@@ -993,6 +1886,65 @@ namespace emscripten {
       return results;
     }
 
+    /// @brief Runs nQueries searches in one call and returns flat, row major typed arrays: `distances` (Float32Array) and `neighbors` (Uint32Array) of nQueries * k entries, closest first.  Queries run in parallel in the threads build.
+    /// @param queries Float32Array (or number array) of nQueries * dim values
+    /// @param nQueries 
+    /// @param k 
+    /// @param js_filterFn applied to every query, a JS function runs the queries serially on the calling thread
+    /// @return 
+    emscripten::val searchKnnBatch(emscripten::val queries, uint32_t nQueries, uint32_t k, emscripten::val js_filterFn) {
+      if (index_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
+        throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
+      }
+
+      if (k > index_->max_elements_) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Invalid the number of k-nearest neighbors (cannot be given a value greater than `maxElements`: %zu).\n", index_->max_elements_);
+        throw std::invalid_argument("Invalid the number of k-nearest neighbors (cannot be given a value greater than `maxElements`: " +
+          std::to_string(index_->max_elements_) + ").");
+      }
+      if (k <= 0) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Invalid the number of k-nearest neighbors (must be a positive number).\n");
+        throw std::invalid_argument("Invalid the number of k-nearest neighbors (must be a positive number).");
+      }
+
+      // one bulk copy for typed arrays instead of an element by element conversion
+      std::vector<float> flatQueries = emscripten::convertJSArrayToNumberVector<float>(queries);
+      if (flatQueries.size() != static_cast<size_t>(nQueries) * dim_) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Invalid the given array length (expected %zu, but got %zu).\n", static_cast<size_t>(nQueries) * dim_, flatQueries.size());
+        throw std::invalid_argument("Invalid the given array length (expected " + std::to_string(static_cast<size_t>(nQueries) * dim_) + ", but got " +
+          std::to_string(flatQueries.size()) + ").");
+      }
+
+      // rows with less than k results are padded with an infinite distance and the label 0xFFFFFFFF
+      const size_t resultSize = static_cast<size_t>(nQueries) * k;
+      std::vector<float> distances(resultSize, std::numeric_limits<float>::infinity());
+      std::vector<uint32_t> neighbors(resultSize, std::numeric_limits<uint32_t>::max());
+
+      SearchFilter filter(js_filterFn);
+      const size_t numThreads = filter.callsJs() ? 1 : std::min<size_t>(internal::resolveNumThreads(0), nQueries);
+      try {
+        internal::ParallelFor(0, nQueries, numThreads, [&](size_t row, size_t threadId) {
+          std::priority_queue<std::pair<float, size_t>> knn = searchRow(flatQueries.data() + row * dim_, static_cast<size_t>(k), filter.get());
+          for (int32_t i = static_cast<int32_t>(knn.size()) - 1; i >= 0; i--) {
+            distances[row * k + i] = knn.top().first;
+            neighbors[row * k + i] = static_cast<uint32_t>(knn.top().second);
+            knn.pop();
+          }
+        });
+      }
+      catch (const std::exception& e) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Could not searchKnnBatch %s\n", e.what());
+        throw std::runtime_error("Could not searchKnnBatch " + std::string(e.what()));
+      }
+
+      // the typed arrays are copied out of the wasm heap, so they stay valid when the heap grows
+      emscripten::val results = emscripten::val::object();
+      results.set("distances", emscripten::val::global("Float32Array").new_(emscripten::typed_memory_view(distances.size(), distances.data())));
+      results.set("neighbors", emscripten::val::global("Uint32Array").new_(emscripten::typed_memory_view(neighbors.size(), neighbors.data())));
+      return results;
+    }
+
     uint32_t getCurrentCount() const {
       if (index_ == nullptr) {
         if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
@@ -1024,6 +1976,15 @@ namespace emscripten {
         index_->setEf(static_cast<size_t>(ef));
       }
     }
+
+    void setFilterFallback(bool enabled) {
+      if (index_ == nullptr) {
+        if (EmscriptenFileSystemManager::debugLogs) printf("Search index has not been initialized, call `initIndex` in advance.\n");
+        throw std::runtime_error("Search index has not been initialized, call `initIndex` in advance.");
+      }
+
+      index_->setFilterFallback(enabled);
+    }
   };
 
 
@@ -1049,6 +2010,30 @@ namespace emscripten {
       .constructor<emscripten::val>()
       .function("op", &CustomFilterFunctor::operator());
 
+    emscripten::class_<LabelFilter>("LabelFilter")
+      .function("isAllowed", &LabelFilter::isAllowed)
+      .function("isAllowList", &LabelFilter::isAllowList);
+
+    emscripten::class_<LabelBitsetFilter, emscripten::base<LabelFilter>>("LabelBitsetFilter")
+      .constructor<std::vector<uint32_t>, bool>()
+      .function("add", &LabelBitsetFilter::add)
+      .function("addLabels", &LabelBitsetFilter::addLabels)
+      .function("remove", &LabelBitsetFilter::remove)
+      .function("clear", &LabelBitsetFilter::clear);
+
+    emscripten::class_<LabelRangeFilter, emscripten::base<LabelFilter>>("LabelRangeFilter")
+      .constructor<bool>()
+      .function("addRange", &LabelRangeFilter::addRange)
+      .function("clear", &LabelRangeFilter::clear)
+      .function("getNumRanges", &LabelRangeFilter::getNumRanges);
+
+    emscripten::class_<LabelSetFilter, emscripten::base<LabelFilter>>("LabelSetFilter")
+      .constructor<std::vector<uint32_t>, bool>()
+      .function("add", &LabelSetFilter::add)
+      .function("addLabels", &LabelSetFilter::addLabels)
+      .function("remove", &LabelSetFilter::remove)
+      .function("clear", &LabelSetFilter::clear);
+
 
     emscripten::class_<BruteforceSearch>("BruteforceSearch")
       .constructor<std::string, uint32_t>()
@@ -1061,7 +2046,9 @@ namespace emscripten {
       .function("searchKnn", &BruteforceSearch::searchKnn)
       .function("getMaxElements", &BruteforceSearch::getMaxElements)
       .function("getCurrentCount", &BruteforceSearch::getCurrentCount)
-      .function("getNumDimensions", &BruteforceSearch::getNumDimensions);
+      .function("getNumDimensions", &BruteforceSearch::getNumDimensions)
+      .function("trainProductQuantizer", &BruteforceSearch::trainProductQuantizer)
+      .function("isQuantizerTrained", &BruteforceSearch::isQuantizerTrained);
 
     emscripten::class_<HierarchicalNSW>("HierarchicalNSW")
       .constructor<const std::string&, uint32_t, const std::string&>()
@@ -1074,17 +2061,33 @@ namespace emscripten {
       .function("addPoint", &HierarchicalNSW::addPoint)
       .function("addPoints", &HierarchicalNSW::addPoints)
       .function("addItems", &HierarchicalNSW::addItems)
+      .function("addItemsParallel", &HierarchicalNSW::addItemsParallel)
+      .function("addPointFromHeap", &HierarchicalNSW::addPointFromHeap)
+      .function("addPointsFromHeap", &HierarchicalNSW::addPointsFromHeap)
+      .function("addItemsFromHeap", &HierarchicalNSW::addItemsFromHeap)
       .function("getUsedLabels", &HierarchicalNSW::getUsedLabels)
       .function("getDeletedLabels", &HierarchicalNSW::getDeletedLabels)
       .function("getMaxElements", &HierarchicalNSW::getMaxElements)
       .function("markDelete", &HierarchicalNSW::markDelete)
       .function("markDeleteItems", &HierarchicalNSW::markDeleteItems)
       .function("unmarkDelete", &HierarchicalNSW::unmarkDelete)
+      .function("reorderIndex", &HierarchicalNSW::reorderIndex)
       .function("getCurrentCount", &HierarchicalNSW::getCurrentCount)
       .function("getNumDimensions", &HierarchicalNSW::getNumDimensions)
       .function("getEfSearch", &HierarchicalNSW::getEfSearch)
       .function("setEfSearch", &HierarchicalNSW::setEfSearch)
+      .function("setFilterFallback", &HierarchicalNSW::setFilterFallback)
       .function("searchKnn", &HierarchicalNSW::searchKnn)
+      .function("searchKnnBatch", &HierarchicalNSW::searchKnnBatch)
+      .function("searchKnnFromHeap", &HierarchicalNSW::searchKnnFromHeap)
+      .function("trainQuantizer", &HierarchicalNSW::trainQuantizer)
+      .function("trainProductQuantizer", &HierarchicalNSW::trainProductQuantizer)
+      .function("setAutoSaveOptions", &HierarchicalNSW::setAutoSaveOptions)
+      .function("getPendingAutoSaveChanges", &HierarchicalNSW::getPendingAutoSaveChanges)
+      .function("flushAutoSave", &HierarchicalNSW::flushAutoSave)
+      .function("isQuantizerTrained", &HierarchicalNSW::isQuantizerTrained)
+      .function("getRerankFactor", &HierarchicalNSW::getRerankFactor)
+      .function("setRerankFactor", &HierarchicalNSW::setRerankFactor)
       ;
 
     function("setIdbfsSynced", &setIdbfsSynced);
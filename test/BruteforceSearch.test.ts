@@ -273,6 +273,41 @@ describe('BruteforceSearch', () => {
       });
     });
 
+    describe('when metric space is "l2-pq"', () => {
+      beforeAll(() => {
+        index = new hnswlib.BruteforceSearch('l2-pq', 3);
+      });
+
+      it('throws an error if the index is initialized before the quantizer is trained', () => {
+        expect(index.isQuantizerTrained()).toBe(false);
+        expect(() => index.initIndex(3)).toThrow(
+          'The product quantizer has not been trained, call `trainProductQuantizer` in advance.'
+        );
+      });
+
+      it('throws an error if the number of subvectors does not divide the dimension', () => {
+        expect(() => index.trainProductQuantizer([[1, 2, 3]], 2, 10)).toThrow(
+          'Invalid number of subvectors 2, it must divide the dimension 3.'
+        );
+      });
+
+      it('returns search results from the query lookup table', () => {
+        // fewer samples than centroids, every sample becomes a centroid and the codes are exact
+        const points = [
+          [1, 2, 3],
+          [2, 3, 4],
+          [3, 4, 5],
+        ];
+        index.trainProductQuantizer(points, 3, 10);
+        index.initIndex(3);
+        points.forEach((point, label) => index.addPoint(point, label));
+        expect(index.searchKnn([1, 2, 5], 2, undefined)).toMatchObject({
+          distances: [3, 4],
+          neighbors: [1, 0],
+        });
+      });
+    });
+
     describe('when filter function is given', () => {
       beforeAll(() => {
         index = new hnswlib.BruteforceSearch('l2', 3);
@@ -1,4 +1,11 @@
-import { defaultParams, HierarchicalNSW, hnswParamsForAda, syncFileSystem } from '~dist/hnswlib';
+import {
+  allocateHeapFloat32Array,
+  defaultParams,
+  flushAutoSave,
+  HierarchicalNSW,
+  hnswParamsForAda,
+  syncFileSystem,
+} from '~dist/hnswlib';
 import { createVectorData, generateMetadata, ItemMetadata, sleep, testErrors } from '~test/testHelpers';
 import 'fake-indexeddb/auto';
 import { indexedDB } from 'fake-indexeddb';
@@ -429,6 +436,41 @@ describe('hnswlib.HierarchicalNSW', () => {
     });
   });
 
+  describe('#reorderIndex', () => {
+    let index: HierarchicalNSW;
+    beforeAll(() => {
+      index = new testHnswlibModule.HierarchicalNSW('l2', 3, 'autotest.dat');
+    });
+
+    it('throws an error if called before the index is initialized', () => {
+      expect(() => {
+        index.reorderIndex('bfs');
+      }).toThrow(/Search index has not been initialized, call `initIndex` in advance./);
+    });
+
+    it('throws an error if given an unknown method', () => {
+      index.initIndex(50, ...defaultParams.initIndex);
+      expect(() => {
+        // @ts-expect-error for testing
+        index.reorderIndex('gorder');
+      }).toThrow(/Invalid reorder method gorder, expected bfs or rcm./);
+    });
+
+    it('keeps the labels and the search results', () => {
+      for (let i = 0; i < 50; i++) index.addPoint([i % 7, i % 5, i % 3], i, false);
+      index.markDelete(4);
+      index.setEf(50);
+      const query = [1, 2, 1];
+      const before = index.searchKnn(query, 10, undefined);
+      index.reorderIndex('rcm');
+      expect(index.searchKnn(query, 10, undefined)).toEqual(before);
+      index.reorderIndex('bfs');
+      expect(index.searchKnn(query, 10, undefined)).toEqual(before);
+      expect(index.getDeletedLabels()).toEqual([4]);
+      expect(index.getCurrentCount()).toBe(50);
+    });
+  });
+
   describe('#searchKnn', () => {
     describe('when metric space is "l2"', () => {
       let index: HierarchicalNSW;
@@ -556,6 +598,173 @@ describe('hnswlib.HierarchicalNSW', () => {
           neighbors: [2, 0],
         });
       });
+
+      it('returns the same filtered search results without the fallback', () => {
+        index.setFilterFallback(false);
+        expect(index.searchKnn([1, 2, 5], 4, filter)).toMatchObject({
+          distances: [1, 4],
+          neighbors: [2, 0],
+        });
+        index.setFilterFallback(true);
+      });
+    });
+
+    describe('when a native label filter is given', () => {
+      let index: HierarchicalNSW;
+      const expected = { distances: [1, 4], neighbors: [2, 0] };
+      beforeAll(() => {
+        index = new testHnswlibModule.HierarchicalNSW('l2', 3, 'autotest.dat');
+        index.initIndex(4, ...defaultParams.initIndex);
+        index.addPoint([1, 2, 3], 0, false);
+        index.addPoint([1, 2, 5], 1, false);
+        index.addPoint([1, 2, 4], 2, false);
+        index.addPoint([1, 2, 5], 3, false);
+      });
+
+      it('returns filtered search results with an allow list bitset', () => {
+        const filter = new testHnswlibModule.LabelBitsetFilter([0, 2], true);
+        expect(index.searchKnn([1, 2, 5], 4, filter)).toMatchObject(expected);
+        filter.delete();
+      });
+
+      it('returns filtered search results with a deny list set', () => {
+        const filter = new testHnswlibModule.LabelSetFilter([1, 3], false);
+        expect(filter.isAllowed(0)).toBe(true);
+        expect(filter.isAllowed(1)).toBe(false);
+        expect(index.searchKnn([1, 2, 5], 4, filter)).toMatchObject(expected);
+        filter.delete();
+      });
+
+      it('merges ranges and returns filtered search results with an allow list of ranges', () => {
+        const filter = new testHnswlibModule.LabelRangeFilter(true);
+        filter.addRange(0, 1);
+        filter.addRange(2, 3);
+        filter.addRange(10, 20);
+        filter.addRange(15, 30);
+        expect(filter.getNumRanges()).toBe(3);
+        expect(filter.isAllowed(25)).toBe(true);
+        expect(index.searchKnn([1, 2, 5], 4, filter)).toMatchObject(expected);
+        filter.delete();
+      });
+
+      it('throws an error if given an empty range', () => {
+        const filter = new testHnswlibModule.LabelRangeFilter(true);
+        expect(() => filter.addRange(3, 3)).toThrow('Invalid label range [3, 3), end must be greater than start.');
+        filter.delete();
+      });
+
+      it('applies the filter to every query of searchKnnBatch', () => {
+        const filter = new testHnswlibModule.LabelBitsetFilter([0, 2], true);
+        const result = index.searchKnnBatch(new Float32Array([1, 2, 5, 1, 2, 5]), 2, 2, filter);
+        expect(Array.from(result.neighbors)).toEqual([2, 0, 2, 0]);
+        filter.delete();
+      });
+    });
+  });
+
+  describe('#searchKnnBatch', () => {
+    let index: HierarchicalNSW;
+    beforeAll(() => {
+      index = new testHnswlibModule.HierarchicalNSW('l2', 3, 'autotest.dat');
+      index.initIndex(3, ...defaultParams.initIndex);
+      index.addPoint([1, 2, 3], 0, false);
+      index.addPoint([2, 3, 4], 1, false);
+      index.addPoint([3, 4, 5], 2, false);
+    });
+
+    it('throws an error if given an array with a length different from numQueries * dimensions', () => {
+      expect(() => {
+        index.searchKnnBatch(new Float32Array([1, 2, 5, 4]), 2, 2, undefined);
+      }).toThrow('Invalid the given array length (expected 6, but got 4).');
+    });
+
+    it('throws an error if given the number of neighborhoods exceeding the maximum number of elements', () => {
+      expect(() => {
+        index.searchKnnBatch(new Float32Array([1, 2, 5]), 1, 4, undefined);
+      }).toThrow('Invalid the number of k-nearest neighbors (cannot be given a value greater than `maxElements`: 3).');
+    });
+
+    it('returns the same results as searchKnn as flat typed arrays', () => {
+      const result = index.searchKnnBatch(new Float32Array([1, 2, 5, 3, 4, 6]), 2, 2, undefined);
+      expect(result.distances).toBeInstanceOf(Float32Array);
+      expect(result.neighbors).toBeInstanceOf(Uint32Array);
+      const first = index.searchKnn([1, 2, 5], 2, undefined);
+      const second = index.searchKnn([3, 4, 6], 2, undefined);
+      expect(Array.from(result.distances)).toEqual([...first.distances, ...second.distances]);
+      expect(Array.from(result.neighbors)).toEqual([...first.neighbors, ...second.neighbors]);
+    });
+  });
+
+  describe('when metric space is "l2-sq8"', () => {
+    let index: HierarchicalNSW;
+    const testVectorData = createVectorData(100, 16);
+    beforeAll(() => {
+      index = new testHnswlibModule.HierarchicalNSW('l2-sq8', 16, '');
+      index.initIndex(100, ...defaultParams.initIndex);
+    });
+
+    it('throws an error if points are added before the quantizer is trained', () => {
+      expect(index.isQuantizerTrained()).toBe(false);
+      expect(() => index.addPoint(testVectorData.vectors[0], 0, false)).toThrow(
+        'The quantizer has not been trained, call `trainQuantizer` in advance.'
+      );
+    });
+
+    it('stores quantized points and searches them', () => {
+      index.trainQuantizer(testVectorData.vectors, false);
+      index.addPoints(testVectorData.vectors, testVectorData.labels, false);
+      expect(index.getCurrentCount()).toBe(100);
+      // one 8 bit step of the [0, 1) range
+      const point = Array.from(index.getPoint(5));
+      point.forEach((value, i) => expect(Math.abs(value - testVectorData.vectors[5][i])).toBeLessThan(1 / 255));
+      expect(index.searchKnn(testVectorData.vectors[5], 1, undefined).neighbors).toEqual([5]);
+    });
+
+    it('reranks the candidates with the float query', () => {
+      index.setRerankFactor(4);
+      const result = index.searchKnn(testVectorData.vectors[7], 3, undefined);
+      expect(result.neighbors[0]).toBe(7);
+      expect(result.distances[0]).toBeLessThan(16 / 255 ** 2);
+      index.setRerankFactor(1);
+    });
+
+    it('throws an error if the quantizer is retrained after points have been added', () => {
+      expect(() => index.trainQuantizer(testVectorData.vectors, true)).toThrow(
+        'The quantizer cannot be retrained once points have been added.'
+      );
+    });
+  });
+
+  describe('when metric space is "l2-pq"', () => {
+    let index: HierarchicalNSW;
+    const testVectorData = createVectorData(100, 16);
+    beforeAll(() => {
+      index = new testHnswlibModule.HierarchicalNSW('l2-pq', 16, '');
+    });
+
+    it('throws an error if the index is initialized before the quantizer is trained', () => {
+      expect(() => index.initIndex(100, ...defaultParams.initIndex)).toThrow(
+        'The product quantizer has not been trained, call `trainProductQuantizer` in advance.'
+      );
+    });
+
+    it('stores product quantized points and searches them', () => {
+      // fewer samples than centroids, every sample becomes a centroid and the codes are exact
+      index.trainProductQuantizer(testVectorData.vectors, 8, 10);
+      expect(index.isQuantizerTrained()).toBe(true);
+      index.initIndex(100, ...defaultParams.initIndex);
+      index.addPoints(testVectorData.vectors, testVectorData.labels, false);
+      expect(index.getCurrentCount()).toBe(100);
+      Array.from(index.getPoint(5)).forEach((value, i) => expect(value).toBeCloseTo(testVectorData.vectors[5][i], 6));
+      const result = index.searchKnn(testVectorData.vectors[5], 1, undefined);
+      expect(result.neighbors).toEqual([5]);
+      expect(result.distances[0]).toBeCloseTo(0, 6);
+    });
+
+    it('throws an error if the quantizer is retrained after the index has been initialized', () => {
+      expect(() => index.trainProductQuantizer(testVectorData.vectors, 8, 10)).toThrow(
+        'The product quantizer cannot be retrained once the index has been initialized.'
+      );
     });
   });
 
@@ -596,6 +805,20 @@ describe('hnswlib.HierarchicalNSW', () => {
       index.readIndex(filename, 10);
       expect(index.getPoint(1)).toMatchObject([2, 3, 4]);
     });
+
+    it('restores the used and deleted labels', async () => {
+      index.markDelete(1);
+      index.writeIndex(filename);
+      index = new testHnswlibModule.HierarchicalNSW('ip', 3, 'autotest.dat');
+      index.readIndex(filename, 10);
+      expect(index.getUsedLabels()).toEqual(expect.arrayContaining([0, 2]));
+      expect(index.getDeletedLabels()).toEqual([1]);
+    });
+
+    it('keeps the index when a read fails', async () => {
+      expect(() => index.readIndex('missing.dat', 10)).toThrow();
+      expect(index.getPoint(2)).toMatchObject([3, 4, 5]);
+    });
   });
 
   describe('#read index', () => {
@@ -645,6 +868,27 @@ describe('hnswlib.HierarchicalNSW', () => {
       expect(index.getUsedLabels().length).toBe(baseIndexSize - 1);
     });
 
+    it(`when loading ${baseIndexSize} points with a debounced autosave, then they are saved once when flushed`, async () => {
+      index.setAutoSaveOptions(10000, 0, 0);
+      index.initIndex(500, ...defaultParams.initIndex);
+      testVectorData.vectors.forEach((vec, i) => index.addPoint(vec, testVectorData.labels[i], false));
+      expect(index.getPendingAutoSaveChanges()).toBe(baseIndexSize - 1);
+      await flushAutoSave(index);
+      expect(index.getPendingAutoSaveChanges()).toBe(0);
+      index.readIndex('autotest.dat', 500);
+      expect(index.getPoint(testVectorData.labels[1])).toMatchObject(testVectorData.vectors[1]);
+      expect(index.getUsedLabels().length).toBe(baseIndexSize - 1);
+    });
+
+    it(`when loading ${baseIndexSize} points with a maximum of pending changes, then they are saved in batches`, () => {
+      index.setAutoSaveOptions(10000, 10, 0);
+      index.initIndex(500, ...defaultParams.initIndex);
+      testVectorData.vectors.forEach((vec, i) => index.addPoint(vec, testVectorData.labels[i], false));
+      expect(index.getPendingAutoSaveChanges()).toBe((baseIndexSize - 1) % 10);
+      index.flushAutoSave(undefined);
+      expect(index.getPendingAutoSaveChanges()).toBe(0);
+    });
+
     it(`when loading ${baseIndexSize} points with multiple addItems, then they can be loaded and fetched`, () => {
       index.initIndex(500, ...defaultParams.initIndex);
       const labels = index.addItems(testVectorData.vectors, false);
@@ -658,6 +902,49 @@ describe('hnswlib.HierarchicalNSW', () => {
       expect(index.getPoint(label2)).toMatchObject(point2);
       expect(() => index.writeIndex(filename)).not.toThrow();
     });
+
+    it(`when loading ${baseIndexSize} points with addItems replacing deleted points, then the deleted labels are reused first`, () => {
+      index.initIndex(500, ...defaultParams.initIndex);
+      const labels = index.addItems(testVectorData.vectors, false);
+      index.markDeleteItems([labels[3], labels[7]]);
+      const replaced = index.addItems(testVectorData.vectors.slice(0, 3), true);
+      expect(replaced.slice(0, 2)).toEqual(expect.arrayContaining([labels[3], labels[7]]));
+      expect(replaced[2]).toBe(baseIndexSize - 1);
+      expect(index.getDeletedLabels()).toEqual([]);
+      replaced.forEach((label, i) => expect(index.getPoint(label)).toMatchObject(testVectorData.vectors[i]));
+      expect(index.getUsedLabels().length).toBe(baseIndexSize);
+
+      index.writeIndex(filename);
+      index.readIndex(filename, 500);
+      replaced.forEach((label, i) => expect(index.getPoint(label)).toMatchObject(testVectorData.vectors[i]));
+      expect(index.getUsedLabels().length).toBe(baseIndexSize);
+      expect(index.addItems(testVectorData.vectors.slice(0, 1), true)).toEqual([baseIndexSize]);
+    });
+
+    it(`when loading ${baseIndexSize} points with addItemsParallel, then they can be loaded and fetched`, () => {
+      index.initIndex(500, ...defaultParams.initIndex);
+      const labels = index.addItemsParallel(testVectorData.vectors, 0, false);
+      expect(labels).toEqual(testVectorData.labels);
+      expect(index.getCurrentCount()).toBe(baseIndexSize - 1);
+      expect(index.getPoint(labels[1])).toMatchObject(testVectorData.vectors[1]);
+      expect(index.searchKnn(testVectorData.vectors[10], 1, undefined).neighbors).toEqual([labels[10]]);
+    });
+
+    it(`when loading ${baseIndexSize} points with addItemsFromHeap, then they can be loaded and searched`, () => {
+      index.initIndex(500, ...defaultParams.initIndex);
+      const dim = hnswParamsForAda.dimensions;
+      const heap = allocateHeapFloat32Array(testHnswlibModule, testVectorData.vectors.length * dim);
+      testVectorData.vectors.forEach((vec, i) => heap.array.set(vec, i * dim));
+      const labels = index.addItemsFromHeap(heap.ptr, testVectorData.vectors.length, false);
+      expect(labels).toEqual(testVectorData.labels);
+      expect(index.getPoint(labels[1])).toMatchObject(testVectorData.vectors[1]);
+
+      const queryPtr = heap.ptr + 10 * dim * Float32Array.BYTES_PER_ELEMENT;
+      expect(index.searchKnnFromHeap(queryPtr, 1, undefined)).toEqual(
+        index.searchKnn(testVectorData.vectors[10], 1, undefined)
+      );
+      testHnswlibModule._free(heap.ptr);
+    });
   });
 
   describe('when a large block of data and dimensions is loaded', () => {
@@ -64,5 +64,15 @@ describe('InnerProductSpace', () => {
       expect(space.distance([1, 2, 3], [3, 4, 5])).toBeCloseTo(-25.0, 6);
       expect(space.distance([0.1, 0.2, 0.3], [0.3, 0.4, 0.5])).toBeCloseTo(0.74, 6);
     });
+
+    it('matches the scalar result for dimensions using the 16 wide, 4 wide and residual kernels', () => {
+      for (const dim of [4, 7, 16, 19, 36, 1536]) {
+        const dimSpace = new hnswlib.InnerProductSpace(dim);
+        const a = Array.from({ length: dim }, (_, i) => (i % 7) * 0.25);
+        const b = Array.from({ length: dim }, (_, i) => (i % 5) * 0.5);
+        const expected = 1 - a.reduce((acc, v, i) => acc + v * b[i], 0);
+        expect(Math.abs(dimSpace.distance(a, b) - expected) / Math.max(1, Math.abs(expected))).toBeLessThan(1e-5);
+      }
+    });
   });
 });
@@ -76,5 +76,15 @@ describe('L2Space', () => {
       //   8
       // );
     });
+
+    it('matches the scalar result for dimensions using the 16 wide, 4 wide and residual kernels', () => {
+      for (const dim of [4, 7, 16, 19, 36, 1536]) {
+        const dimSpace = new hnswlib.L2Space(dim);
+        const a = Array.from({ length: dim }, (_, i) => (i % 7) * 0.25);
+        const b = Array.from({ length: dim }, (_, i) => (i % 5) * 0.5);
+        const expected = a.reduce((acc, v, i) => acc + (v - b[i]) * (v - b[i]), 0);
+        expect(Math.abs(dimSpace.distance(a, b) - expected) / Math.max(1, expected)).toBeLessThan(1e-5);
+      }
+    });
   });
 });